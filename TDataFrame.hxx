@@ -14,22 +14,45 @@
 
 #include "TBranchElement.h"
 #include "TDirectory.h"
+#include "TFile.h" // GetBytesRead, for the statistics of the event loop
 #include "TH1F.h" // For Histo actions
+#include "TH2F.h" // For Histo actions
+#include "TH3F.h" // For Histo actions
+#include "TProfile.h" // For Profile actions
+#include "TProfile2D.h" // For Profile actions
+#include "TList.h"
 #include "TROOT.h" // IsImplicitMTEnabled, GetImplicitMTPoolSize
 #include "ROOT/TSpinMutex.hxx"
 #include "ROOT/TTreeProcessor.hxx"
 #include "TTreeReader.h"
 #include "TTreeReaderValue.h"
+#ifdef R__USE_IMT
+#include "ROOT/TThreadExecutor.hxx" // to merge the results of actions in parallel
+#endif // R__USE_IMT
 
-#include <algorithm> // std::find
+#include <algorithm> // std::find, std::all_of, std::none_of
 #include <array>
+#include <atomic>
+#include <chrono> // std::chrono::steady_clock, to time named filters
+#include <cmath> // std::abs, std::sqrt
+#include <cstdio> // std::tmpfile, for actions spilling to disk; std::printf
+#include <cstring> // std::memcmp
+#include <ctime> // std::clock, for the CPU time of the event loop
+#include <functional> // std::less, std::hash
+#include <iterator> // std::back_inserter
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <type_traits> // std::decay
 #include <typeinfo>
+#include <unordered_set>
 #include <vector>
+#ifndef _WIN32
+#include <sys/types.h> // off_t, for the 64-bit seeks in spill files
+#endif
 
 // Meta programming utilities, perhaps to be moved in core/foundation
 namespace ROOT {
@@ -109,6 +132,13 @@ struct TGenStaticSeq<0, S...> {
    using Type_t = TStaticSeq<S...>;
 };
 
+// true if all Bs are true, e.g. TAllOf<true, false>::value == false
+template <bool... Bs>
+struct TBoolPack { };
+
+template <bool... Bs>
+struct TAllOf : std::is_same<TBoolPack<true, Bs...>, TBoolPack<Bs..., true>> { };
+
 template <typename T>
 struct TIsContainer {
    using Test_t = typename std::decay<T>::type;
@@ -140,6 +170,31 @@ struct TIsContainer {
    static const bool fgValue = Test<Test_t>(nullptr);
 };
 
+// The type of the elements of T if it is a container, T itself otherwise
+template <typename T, bool IsContainer = TIsContainer<T>::fgValue>
+struct TValueType {
+   using Type_t = T;
+};
+
+template <typename T>
+struct TValueType<T, true> {
+   using Type_t = typename T::value_type;
+};
+
+// Whether calling a T cannot change the T itself: true for function pointers and for
+// classes with a const call operator, false for mutable lambdas and non-const functors
+template <typename T>
+struct TIsConstCallable : TIsConstCallable<decltype(&T::operator())> { };
+
+template <typename R, typename T, typename... Args>
+struct TIsConstCallable<R (T::*)(Args...) const> : std::true_type { };
+
+template <typename R, typename T, typename... Args>
+struct TIsConstCallable<R (T::*)(Args...)> : std::false_type { };
+
+template <typename R, typename... Args>
+struct TIsConstCallable<R (*)(Args...)> : std::true_type { };
+
 } // end NS TDFTraitsUtils
 
 } // end NS Internal
@@ -235,6 +290,322 @@ public:
    }
 };
 
+/**
+* \class ROOT::TFlatCollection
+* \brief The values of a collection-type branch for many entries, stored contiguously
+* \tparam T Type of the elements of the collections
+*
+* The elements of the collections of all entries are stored in a single vector,
+* in entry order. The elements of the i-th entry are those in the range
+* `[GetOffsets()[i], GetOffsets()[i+1])` of `GetValues()`.
+*/
+template <typename T>
+class TFlatCollection {
+   std::vector<T> fValues;
+   std::vector<std::size_t> fOffsets = {0};
+
+public:
+   std::vector<T> &GetValues() { return fValues; }
+   const std::vector<T> &GetValues() const { return fValues; }
+   std::vector<std::size_t> &GetOffsets() { return fOffsets; }
+   const std::vector<std::size_t> &GetOffsets() const { return fOffsets; }
+   std::size_t GetNEntries() const { return fOffsets.size() - 1; }
+   /// Number of elements of the collection of the i-th entry
+   std::size_t GetSize(std::size_t i) const { return fOffsets[i + 1] - fOffsets[i]; }
+   /// Pointer to the first element of the collection of the i-th entry
+   const T *GetData(std::size_t i) const { return fValues.data() + fOffsets[i]; }
+};
+
+namespace Internal {
+// A sum with Neumaier's compensation: the rounding error of every addition is
+// accumulated separately and added back at the end, so that the result does not
+// depend on the magnitude or on the order of the summed values beyond rounding
+class TCompensatedSum {
+   double fSum = 0.;
+   double fCompensation = 0.;
+
+public:
+   void Add(double x)
+   {
+      const double t = fSum + x;
+      if (std::abs(fSum) >= std::abs(x))
+         fCompensation += (fSum - t) + x;
+      else
+         fCompensation += (x - t) + fSum;
+      fSum = t;
+   }
+   void Add(const TCompensatedSum &other)
+   {
+      Add(other.fSum);
+      Add(other.fCompensation);
+   }
+   double GetSum() const { return fSum + fCompensation; }
+};
+} // end NS Internal
+
+/**
+* \class ROOT::TStatistics
+* \brief Number of values, sum, mean, variance, minimum and maximum of a set of values
+*
+* The mean and the sum of squared deviations from the mean are updated with
+* Welford's algorithm, which does not suffer from the cancellation of the
+* textbook `sum(x*x) - sum(x)*sum(x)/n` formula. Two sets of statistics are
+* combined exactly (up to rounding) by Merge, which is how the partial results
+* of the processing slots are put together: results do not drift with the
+* number of threads.
+*/
+class TStatistics {
+   ULong64_t fN = 0;
+   double fMean = 0.;
+   double fM2 = 0.; // sum of squared deviations from the mean
+   double fMin = std::numeric_limits<double>::max();
+   double fMax = std::numeric_limits<double>::lowest();
+   Internal::TCompensatedSum fSum;
+
+public:
+   void Fill(double x)
+   {
+      ++fN;
+      const double delta = x - fMean;
+      fMean += delta / fN;
+      fM2 += delta * (x - fMean);
+      fMin = std::min(x, fMin);
+      fMax = std::max(x, fMax);
+      fSum.Add(x);
+   }
+   /// Combine with the statistics of another set of values (Chan et al.)
+   void Merge(const TStatistics &other)
+   {
+      if (other.fN == 0) return;
+      if (fN == 0) {
+         *this = other;
+         return;
+      }
+      const double n = fN, otherN = other.fN, totN = n + otherN;
+      const double delta = other.fMean - fMean;
+      fMean += delta * (otherN / totN);
+      fM2 += other.fM2 + delta * delta * (n * otherN / totN);
+      fN += other.fN;
+      fMin = std::min(other.fMin, fMin);
+      fMax = std::max(other.fMax, fMax);
+      fSum.Add(other.fSum);
+   }
+   ULong64_t GetN() const { return fN; }
+   double GetSum() const { return fSum.GetSum(); }
+   double GetMean() const { return fMean; }
+   /// Unbiased estimate of the variance, with `n - 1` in the denominator. Zero for less than two values.
+   double GetVariance() const { return fN > 1 ? fM2 / (fN - 1) : 0.; }
+   double GetStdDev() const { return std::sqrt(GetVariance()); }
+   double GetMin() const { return fMin; }
+   double GetMax() const { return fMax; }
+};
+
+/**
+* \class ROOT::TCovariance
+* \brief Means and covariance matrix of a set of variables
+*
+* Filled with one value per variable at a time. The means and the sums of
+* products of deviations from the means are updated with the multivariate
+* form of Welford's algorithm, a rank-1 update of the upper triangle of the
+* matrix, stored packed row by row. Merge combines two sets exactly (up to
+* rounding), as TStatistics::Merge does.
+*/
+class TCovariance {
+   std::vector<std::string> fNames;
+   ULong64_t fN = 0;
+   std::vector<double> fMeans;
+   std::vector<double> fComoments; // upper triangle, packed row by row
+   std::vector<double> fDeltas;    // scratch space for Fill
+
+   std::size_t GetIndex(std::size_t i, std::size_t j) const
+   {
+      if (i > j) std::swap(i, j);
+      return i * fNames.size() - i * (i - 1) / 2 + (j - i);
+   }
+
+   // comoments += f * d d^T
+   void AddOuterProduct(const double *d, double f)
+   {
+      const std::size_t n = fNames.size();
+      double *row = fComoments.data();
+      for (std::size_t i = 0; i < n; ++i) {
+         const double fdi = f * d[i];
+         const std::size_t rowSize = n - i;
+         const double *di = d + i;
+         for (std::size_t j = 0; j < rowSize; ++j) row[j] += fdi * di[j]; // vectorizable
+         row += rowSize;
+      }
+   }
+
+public:
+   TCovariance() = default;
+   explicit TCovariance(const std::vector<std::string> &names)
+      : fNames(names), fMeans(names.size(), 0.), fComoments(names.size() * (names.size() + 1) / 2, 0.),
+        fDeltas(names.size(), 0.) {}
+
+   /// Add the values of all variables for one entry
+   template <typename T>
+   void Fill(const T *values)
+   {
+      const std::size_t n = fNames.size();
+      ++fN;
+      const double invN = 1. / fN;
+      for (std::size_t i = 0; i < n; ++i) {
+         fDeltas[i] = values[i] - fMeans[i];
+         fMeans[i] += fDeltas[i] * invN;
+      }
+      // (x - oldMean)_i (x - newMean)_j = (n - 1) / n * delta_i delta_j
+      AddOuterProduct(fDeltas.data(), (fN - 1) * invN);
+   }
+
+   /// Combine with the means and covariances of another set of entries of the same variables
+   void Merge(const TCovariance &other)
+   {
+      if (other.fN == 0) return;
+      if (fN == 0) {
+         *this = other;
+         return;
+      }
+      const double n = fN, otherN = other.fN, totN = n + otherN;
+      for (std::size_t i = 0; i < fMeans.size(); ++i) {
+         fDeltas[i] = other.fMeans[i] - fMeans[i];
+         fMeans[i] += fDeltas[i] * (otherN / totN);
+      }
+      for (std::size_t k = 0; k < fComoments.size(); ++k) fComoments[k] += other.fComoments[k];
+      AddOuterProduct(fDeltas.data(), n * otherN / totN);
+      fN += other.fN;
+   }
+
+   const std::vector<std::string> &GetNames() const { return fNames; }
+   ULong64_t GetN() const { return fN; }
+   double GetMean(std::size_t i) const { return fMeans[i]; }
+   /// Unbiased estimate of the covariance, with `n - 1` in the denominator. Zero for less than two entries.
+   double GetCovariance(std::size_t i, std::size_t j) const
+   {
+      return fN > 1 ? fComoments[GetIndex(i, j)] / (fN - 1) : 0.;
+   }
+   /// Pearson's correlation coefficient. Zero if either variable is constant.
+   double GetCorrelation(std::size_t i, std::size_t j) const
+   {
+      const double norm = std::sqrt(fComoments[GetIndex(i, i)] * fComoments[GetIndex(j, j)]);
+      return norm > 0. ? fComoments[GetIndex(i, j)] / norm : 0.;
+   }
+};
+
+/**
+* \class ROOT::TCutInfo
+* \brief The statistics of a named filter: entries it was evaluated on, entries accepted, time spent
+*/
+class TCutInfo {
+   std::string fName;
+   ULong64_t fAll;
+   ULong64_t fPass;
+   double fTime;
+
+public:
+   TCutInfo(const std::string &name, ULong64_t all, ULong64_t pass, double time)
+      : fName(name), fAll(all), fPass(pass), fTime(time) {}
+   const std::string &GetName() const { return fName; }
+   /// Number of entries the filter was evaluated on, i.e. accepted by all filters upstream
+   ULong64_t GetAll() const { return fAll; }
+   /// Number of entries accepted by the filter
+   ULong64_t GetPass() const { return fPass; }
+   /// Fraction of entries accepted by the filter, 0 if it was never evaluated
+   double GetEff() const { return fAll > 0 ? double(fPass) / fAll : 0.; }
+   /// Time spent evaluating the filter, in seconds, summed over all processing slots
+   double GetTime() const { return fTime; }
+};
+
+/**
+* \class ROOT::TCutFlowReport
+* \brief The statistics of all named filters of a TDataFrame, in booking order
+*
+* Returned by TDataFrameInterface::Report. Iterating over it gives TCutInfo objects.
+*/
+class TCutFlowReport {
+   std::vector<TCutInfo> fCuts;
+
+public:
+   void AddCut(const TCutInfo &cut) { fCuts.emplace_back(cut); }
+   std::vector<TCutInfo>::const_iterator begin() const { return fCuts.begin(); }
+   std::vector<TCutInfo>::const_iterator end() const { return fCuts.end(); }
+   std::size_t size() const { return fCuts.size(); }
+   /// The statistics of the filter with the given name. Throws if there is none.
+   const TCutInfo &operator[](const std::string &name) const
+   {
+      for (auto &cut : fCuts)
+         if (cut.GetName() == name) return cut;
+      throw std::runtime_error("No named filter called " + name + " in the report.");
+   }
+   /// Print one line per filter. The cumulative efficiency is relative to the entries seen by the first filter.
+   void Print() const
+   {
+      if (fCuts.empty()) return;
+      const auto all = fCuts.front().GetAll();
+      for (auto &cut : fCuts) {
+         std::printf("%-20s: pass=%-10llu all=%-10llu -- eff=%6.2f %% cumulative eff=%6.2f %% time=%.3f s\n",
+                     cut.GetName().c_str(), (unsigned long long)cut.GetPass(), (unsigned long long)cut.GetAll(),
+                     100. * cut.GetEff(), all > 0 ? 100. * cut.GetPass() / all : 0., cut.GetTime());
+      }
+   }
+};
+
+/// The statistics of the last event loop of a TDataFrame, see TDataFrameInterface::GetRunStats
+class TRunStats {
+   std::vector<ULong64_t> fSlotEntries;
+   ULong64_t fBytesRead = 0;
+   ULong64_t fUncompressedBytes = 0;
+   double fWallTime = 0.;
+   double fCpuTime = 0.;
+
+public:
+   TRunStats() {}
+   TRunStats(const std::vector<ULong64_t> &slotEntries, ULong64_t bytesRead, ULong64_t uncompressedBytes,
+             double wallTime, double cpuTime)
+      : fSlotEntries(slotEntries), fBytesRead(bytesRead), fUncompressedBytes(uncompressedBytes), fWallTime(wallTime),
+        fCpuTime(cpuTime) {}
+   /// The number of entries read, by all processing slots
+   ULong64_t GetEntries() const
+   {
+      ULong64_t entries = 0;
+      for (auto slotEntries : fSlotEntries) entries += slotEntries;
+      return entries;
+   }
+   /// The number of entries read by each processing slot
+   const std::vector<ULong64_t> &GetSlotEntries() const { return fSlotEntries; }
+   /// The number of compressed bytes read from the files
+   ULong64_t GetBytesRead() const { return fBytesRead; }
+   /// The number of bytes read once decompressed, estimated from the compression factor of the TTree
+   ULong64_t GetUncompressedBytes() const { return fUncompressedBytes; }
+   /// The wall-clock time of the event loop, including the merging of the results, in seconds
+   double GetWallTime() const { return fWallTime; }
+   /// The CPU time used by the process during the event loop, by all threads, in seconds
+   double GetCpuTime() const { return fCpuTime; }
+   double GetEntriesPerSecond() const { return fWallTime > 0 ? GetEntries() / fWallTime : 0.; }
+   void Print() const
+   {
+      std::printf("entries=%llu (%.0f/s) bytes read=%llu uncompressed=%llu wall time=%.3f s cpu time=%.3f s\n",
+                  (unsigned long long)GetEntries(), GetEntriesPerSecond(), (unsigned long long)fBytesRead,
+                  (unsigned long long)fUncompressedBytes, fWallTime, fCpuTime);
+      for (std::size_t slot = 0; slot < fSlotEntries.size(); ++slot)
+         std::printf("slot %-3u: entries=%llu\n", (unsigned int)slot, (unsigned long long)fSlotEntries[slot]);
+   }
+   /// The statistics as a JSON object, for monitoring
+   std::string AsJson() const
+   {
+      char buf[256];
+      std::snprintf(buf, sizeof(buf),
+                    "{\"entries\": %llu, \"entries_per_second\": %.6g, \"bytes_read\": %llu, "
+                    "\"uncompressed_bytes\": %llu, \"wall_time\": %.6g, \"cpu_time\": %.6g, \"slot_entries\": [",
+                    (unsigned long long)GetEntries(), GetEntriesPerSecond(), (unsigned long long)fBytesRead,
+                    (unsigned long long)fUncompressedBytes, fWallTime, fCpuTime);
+      std::string json = buf;
+      for (std::size_t slot = 0; slot < fSlotEntries.size(); ++slot)
+         json += (slot ? ", " : "") + std::to_string(fSlotEntries[slot]);
+      return json + "]}";
+   }
+};
+
 } // end NS ROOT
 
 // Internal classes
@@ -254,6 +625,21 @@ unsigned int GetNSlots() {
    return nSlots;
 }
 
+// Calls f(i) for all i in [0, n): as tasks of the thread pool if implicit
+// multi-threading is enabled, one after the other otherwise
+template <typename F>
+void ParallelFor(unsigned int n, F f)
+{
+#ifdef R__USE_IMT
+   if (ROOT::IsImplicitMTEnabled() && n > 1) {
+      ROOT::TThreadExecutor pool;
+      pool.Foreach(f, ROOT::TSeqU(n));
+      return;
+   }
+#endif // R__USE_IMT
+   for (unsigned int i = 0; i < n; ++i) f(i);
+}
+
 using TVBPtr_t = std::shared_ptr<TTreeReaderValueBase>;
 using TVBVec_t = std::vector<TVBPtr_t>;
 
@@ -287,8 +673,25 @@ void CheckFilter(Filter f)
    static_assert(std::is_same<FilterRet_t, bool>::value, "filter functions must return a bool");
 }
 
+// Whether two callables of the same type are known to compute the same thing:
+// stateless ones always do, trivially copyable ones if they hold the same bytes
+// (e.g. function pointers, lambdas capturing numbers or references by value).
+// Callables that can change their own state, e.g. mutable lambdas counting their
+// calls, never are: each copy evolves on its own even if they start out equal.
+template <typename F>
+bool AreSameCallables(const F &f1, const F &f2)
+{
+   return TDFTraitsUtils::TIsConstCallable<F>::value &&
+          (std::is_empty<F>::value ||
+           (std::is_trivially_copyable<F>::value && std::memcmp(&f1, &f2, sizeof(F)) == 0));
+}
+
 void CheckTmpBranch(const std::string& branchName, TTree *treePtr)
 {
+   if (branchName == "tdfentry_") {
+      auto msg = "branch name \"" + branchName + "\" is reserved";
+      throw std::runtime_error(msg);
+   }
    auto branch = treePtr->GetBranch(branchName.c_str());
    if (branch != nullptr) {
       auto msg = "branch \"" + branchName + "\" already present in TTree";
@@ -313,12 +716,215 @@ const BranchVec &PickBranchVec(unsigned int nArgs, const BranchVec &bl, const Br
    return useDefBl ? defBl : bl;
 }
 
+// Statistics of a node of the graph for one processing slot. Each slot only
+// updates its own, the padding keeps those of different slots in different cache lines.
+struct TNodeSlotStats {
+   ULong64_t fAll = 0;  // entries processed by the node, i.e. evaluations for filters and branches
+   ULong64_t fPass = 0; // entries accepted, for filters
+   std::chrono::steady_clock::duration fTime{0};
+   char fPadding[128 - 2 * sizeof(ULong64_t) - sizeof(std::chrono::steady_clock::duration)];
+};
+
+// Measures the time spent by one processing slot in the nodes of the graph.
+// Regions can be nested, e.g. a temporary branch computed while evaluating a
+// filter: the time of the inner region is only attributed to the inner node.
+class TSlotProfiler {
+   // total time of the regions closed so far, at the current nesting level
+   std::chrono::steady_clock::duration fTotal{0};
+   char fPadding[128 - sizeof(std::chrono::steady_clock::duration)];
+
+public:
+   std::chrono::steady_clock::duration GetTotal() const { return fTotal; }
+
+   // close a region opened at start, when the total was totalAtStart, and add
+   // the time spent in it but not in the regions nested in it to ownTime
+   void Close(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::duration totalAtStart,
+              std::chrono::steady_clock::duration &ownTime)
+   {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      ownTime += elapsed - (fTotal - totalAtStart);
+      fTotal = totalAtStart + elapsed;
+   }
+};
+
+// A region of the event loop timed for the lifetime of the object. Nothing is
+// measured if the profiler is null, i.e. if the node is not timed.
+class TProfiledRegion {
+   TSlotProfiler *fProfiler;
+   std::chrono::steady_clock::duration &fOwnTime;
+   std::chrono::steady_clock::time_point fStart;
+   std::chrono::steady_clock::duration fTotalAtStart;
+
+public:
+   TProfiledRegion(TSlotProfiler *profiler, std::chrono::steady_clock::duration &ownTime)
+      : fProfiler(profiler), fOwnTime(ownTime)
+   {
+      if (!fProfiler) return;
+      fTotalAtStart = fProfiler->GetTotal();
+      fStart = std::chrono::steady_clock::now();
+   }
+   TProfiledRegion(const TProfiledRegion &) = delete;
+   ~TProfiledRegion()
+   {
+      if (fProfiler) fProfiler->Close(fStart, fTotalAtStart, fOwnTime);
+   }
+};
+
+// A node of the graph with the sum of its statistics, as exported by TDataFrameInterface::GetGraph
+struct TGraphNode {
+   std::string fType;  // "TDataFrame", "Filter", "AddBranch" or "Action"
+   std::string fLabel;
+   // given to the node when it is booked, see TDataFrameImpl::NewGraphId. 0 for no node.
+   unsigned int fId = 0;
+   unsigned int fPrevId = 0; // the node upstream, 0 for the TDataFrame itself
+   ULong64_t fAll = 0;
+   ULong64_t fPass = 0;
+   double fTime = -1.; // in seconds, negative if the node was not timed
+
+   TGraphNode(const std::string &type, const std::string &label, unsigned int id, unsigned int prevId)
+      : fType(type), fLabel(label), fId(id), fPrevId(prevId) {}
+
+   void AddStats(const std::vector<TNodeSlotStats> &stats, bool isTimed)
+   {
+      std::chrono::steady_clock::duration time(0);
+      for (auto &slotStats : stats) {
+         fAll += slotStats.fAll;
+         fPass += slotStats.fPass;
+         time += slotStats.fTime;
+      }
+      if (isTimed) fTime = std::chrono::duration<double>(time).count();
+   }
+};
+
+// A span of time in the event loop of a processing slot, exported by TDataFrameInterface::GetTrace
+struct TTraceEvent {
+   const char *fName;
+   std::chrono::steady_clock::time_point fStart;
+   std::chrono::steady_clock::time_point fEnd;
+   Long64_t fFirstEntry; // for tasks: the first entry processed, -1 if none
+   ULong64_t fNEntries;  // for tasks: the number of entries processed
+
+   TTraceEvent(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+               Long64_t firstEntry = -1, ULong64_t nEntries = 0)
+      : fName(name), fStart(start), fEnd(end), fFirstEntry(firstEntry), fNEntries(nEntries) {}
+};
+
+// The names of the branches, comma-separated, to label nodes of the graph
+std::string JoinBranchNames(const BranchVec &bl)
+{
+   std::string names;
+   for (auto &name : bl) names += (names.empty() ? "" : ", ") + name;
+   return names;
+}
+
+std::string EscapeGraphLabel(const std::string &label)
+{
+   std::string escaped;
+   for (auto c : label) {
+      if (c == '"' || c == '\\') escaped += '\\';
+      if (c == '\n') escaped += "\\n";
+      else escaped += c;
+   }
+   return escaped;
+}
+
+// The events of a run in the Chrome trace event format, readable by chrome://tracing and Perfetto.
+// There is one lane of events per slot, and a last one for the merging of the results.
+std::string TraceToJson(const std::vector<std::vector<TTraceEvent>> &lanes, std::chrono::steady_clock::time_point origin)
+{
+   const auto toMicroseconds = [](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration<double, std::micro>(d).count();
+   };
+   std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+   char buf[256];
+   for (std::size_t tid = 0; tid < lanes.size(); ++tid) {
+      const auto laneName = tid + 1 < lanes.size() ? "slot " + std::to_string(tid) : std::string("merge");
+      json += tid ? ",\n" : "\n";
+      json += "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " + std::to_string(tid) +
+              ", \"args\": {\"name\": \"" + laneName + "\"}}";
+      for (auto &event : lanes[tid]) {
+         std::snprintf(buf, sizeof(buf),
+                       ",\n  {\"name\": \"%s\", \"cat\": \"TDataFrame\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                       "\"ts\": %.3f, \"dur\": %.3f",
+                       event.fName, static_cast<unsigned int>(tid), toMicroseconds(event.fStart - origin),
+                       toMicroseconds(event.fEnd - event.fStart));
+         json += buf;
+         if (event.fNEntries) {
+            std::snprintf(buf, sizeof(buf), ", \"args\": {\"first entry\": %lld, \"entries\": %llu}",
+                          static_cast<long long>(event.fFirstEntry), static_cast<unsigned long long>(event.fNEntries));
+            json += buf;
+         }
+         json += "}";
+      }
+   }
+   return json + "\n]}\n";
+}
+
+// The graph in the dot language of Graphviz, with the statistics of each node in its label
+std::string GraphToDot(const std::vector<TGraphNode> &nodes)
+{
+   std::map<unsigned int, unsigned int> ids; // to the position of the node
+   for (auto &node : nodes) ids.emplace(node.fId, ids.size());
+   std::string dot = "digraph TDataFrame {\n";
+   char buf[64];
+   for (auto &node : nodes) {
+      std::string label = EscapeGraphLabel(node.fLabel) + "\\nentries: " + std::to_string(node.fAll);
+      if (node.fType == "Filter") {
+         std::snprintf(buf, sizeof(buf), "%.2f%%", node.fAll ? 100. * node.fPass / node.fAll : 0.);
+         label += "\\npass: " + std::to_string(node.fPass) + " (" + buf + ")";
+      }
+      if (node.fTime >= 0) {
+         std::snprintf(buf, sizeof(buf), "%.6g s", node.fTime);
+         label += std::string("\\ntime: ") + buf;
+      }
+      const char *shape = node.fType == "Filter" ? "diamond" : node.fType == "Action" ? "box" : "ellipse";
+      dot += "   n" + std::to_string(ids[node.fId]) + " [shape=" + shape + ", label=\"" + label + "\"];\n";
+   }
+   for (auto &node : nodes) {
+      auto prev = ids.find(node.fPrevId);
+      if (prev == ids.end()) continue;
+      dot += "   n" + std::to_string(prev->second) + " -> n" + std::to_string(ids[node.fId]) + ";\n";
+   }
+   return dot + "}\n";
+}
+
+// The graph as a JSON object with an array of nodes and one of edges, from upstream to downstream node ids
+std::string GraphToJson(const std::vector<TGraphNode> &nodes)
+{
+   std::map<unsigned int, unsigned int> ids; // to the position of the node
+   for (auto &node : nodes) ids.emplace(node.fId, ids.size());
+   std::string json = "{\"nodes\": [";
+   char buf[64];
+   for (auto &node : nodes) {
+      json += ids[node.fId] ? ",\n" : "\n";
+      json += "  {\"id\": " + std::to_string(ids[node.fId]) + ", \"type\": \"" + node.fType + "\", \"label\": \"" +
+              EscapeGraphLabel(node.fLabel) + "\", \"entries\": " + std::to_string(node.fAll);
+      if (node.fType == "Filter") json += ", \"pass\": " + std::to_string(node.fPass);
+      if (node.fTime >= 0) {
+         std::snprintf(buf, sizeof(buf), "%.9g", node.fTime);
+         json += std::string(", \"time\": ") + buf;
+      }
+      json += "}";
+   }
+   json += "\n], \"edges\": [";
+   bool first = true;
+   for (auto &node : nodes) {
+      auto prev = ids.find(node.fPrevId);
+      if (prev == ids.end()) continue;
+      json += first ? "\n" : ",\n";
+      json += "  {\"from\": " + std::to_string(prev->second) + ", \"to\": " + std::to_string(ids[node.fId]) + "}";
+      first = false;
+   }
+   return json + "\n]}\n";
+}
+
 class TDataFrameActionBase {
 public:
    virtual ~TDataFrameActionBase() {}
    virtual void Run(unsigned int slot, int entry) = 0;
    virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
    virtual void CreateSlots(unsigned int nSlots) = 0;
+   virtual TGraphNode GetGraphNode() const = 0;
 };
 
 using ActionBasePtr_t = std::shared_ptr<TDataFrameActionBase>;
@@ -339,19 +945,26 @@ class TDataFrameAction final : public TDataFrameActionBase {
    const BranchVec fTmpBranches;
    PrevDataFrame *fPrevData;
    std::weak_ptr<Details::TDataFrameImpl> fFirstData;
+   const unsigned int fGraphId;
    std::vector<TVBVec_t> fReaderValues;
+   std::vector<TNodeSlotStats> fStats;
+   TSlotProfiler *fProfilers = nullptr; // null unless profiling
 
 public:
    TDataFrameAction(F f, const BranchVec &bl, std::weak_ptr<PrevDataFrame> pd)
       : fAction(f), fBranches(bl), fTmpBranches(pd.lock()->GetTmpBranches()), fPrevData(pd.lock().get()),
-        fFirstData(pd.lock()->GetDataFrame()) { }
+        fFirstData(pd.lock()->GetDataFrame()), fGraphId(pd.lock()->GetDataFrame().lock()->NewGraphId()) { }
 
    TDataFrameAction(const TDataFrameAction &) = delete;
 
    void Run(unsigned int slot, int entry)
    {
       // check if entry passes all filters
-      if (CheckFilters(slot, entry)) ExecuteAction(slot, entry);
+      if (CheckFilters(slot, entry)) {
+         ++fStats[slot].fAll;
+         const TProfiledRegion region(fProfilers ? &fProfilers[slot] : nullptr, fStats[slot].fTime);
+         ExecuteAction(slot, entry);
+      }
    }
 
    bool CheckFilters(unsigned int slot, int entry)
@@ -362,13 +975,25 @@ public:
 
    void ExecuteAction(unsigned int slot, int entry) { ExecuteActionHelper(slot, entry, TypeInd_t(), BranchTypes_t()); }
 
-   void CreateSlots(unsigned int nSlots) { fReaderValues.resize(nSlots); }
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fStats.resize(nSlots);
+      fProfilers = fPrevData->GetDataFrame().lock()->GetSlotProfilers();
+   }
 
    void BuildReaderValues(TTreeReader &r, unsigned int slot)
    {
       fReaderValues[slot] = ROOT::Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
    }
 
+   TGraphNode GetGraphNode() const
+   {
+      TGraphNode node("Action", "Action(" + JoinBranchNames(fBranches) + ")", fGraphId, fPrevData->GetGraphId());
+      node.AddStats(fStats, fProfilers);
+      return node;
+   }
+
    template <int... S, typename... BranchTypes>
    void ExecuteActionHelper(unsigned int slot, int entry,
                             TDFTraitsUtils::TStaticSeq<S...>,
@@ -382,6 +1007,129 @@ public:
    }
 };
 
+// An action on a number of branches of the same type, known only at runtime.
+// The values of the branches for the current entry are gathered in a
+// contiguous array, which is passed to the action function with the slot.
+template <typename T, typename F, typename PrevDataFrame>
+class TDataFrameArrayAction final : public TDataFrameActionBase {
+   F fAction;
+   const BranchVec fBranches;
+   const BranchVec fTmpBranches;
+   PrevDataFrame *fPrevData;
+   std::weak_ptr<Details::TDataFrameImpl> fFirstData;
+   const unsigned int fGraphId;
+   std::vector<TVBVec_t> fReaderValues;
+   std::vector<std::vector<T>> fValues; // per slot, one per branch
+   std::vector<TNodeSlotStats> fStats;
+   TSlotProfiler *fProfilers = nullptr; // null unless profiling
+
+public:
+   TDataFrameArrayAction(F f, const BranchVec &bl, std::weak_ptr<PrevDataFrame> pd)
+      : fAction(f), fBranches(bl), fTmpBranches(pd.lock()->GetTmpBranches()), fPrevData(pd.lock().get()),
+        fFirstData(pd.lock()->GetDataFrame()), fGraphId(pd.lock()->GetDataFrame().lock()->NewGraphId()) { }
+
+   TDataFrameArrayAction(const TDataFrameArrayAction &) = delete;
+
+   void Run(unsigned int slot, int entry)
+   {
+      if (!fPrevData->CheckFilters(slot, entry)) return;
+      ++fStats[slot].fAll;
+      const TProfiledRegion region(fProfilers ? &fProfilers[slot] : nullptr, fStats[slot].fTime);
+      auto &values = fValues[slot];
+      auto &readerValues = fReaderValues[slot];
+      for (std::size_t i = 0; i < fBranches.size(); ++i)
+         values[i] = GetBranchValue<0, T>(readerValues[i], slot, entry, fBranches[i], fFirstData);
+      fAction(slot, values.data());
+   }
+
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fValues.assign(nSlots, std::vector<T>(fBranches.size()));
+      fStats.resize(nSlots);
+      fProfilers = fPrevData->GetDataFrame().lock()->GetSlotProfilers();
+   }
+
+   TGraphNode GetGraphNode() const
+   {
+      TGraphNode node("Action", "Action(" + JoinBranchNames(fBranches) + ")", fGraphId, fPrevData->GetGraphId());
+      node.AddStats(fStats, fProfilers);
+      return node;
+   }
+
+   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+   {
+      auto &readerValues = fReaderValues[slot];
+      readerValues.clear();
+      for (auto &branch : fBranches) {
+         const bool isTmpBranch = std::find(fTmpBranches.begin(), fTmpBranches.end(), branch) != fTmpBranches.end();
+         readerValues.emplace_back(isTmpBranch ? nullptr : std::make_shared<TTreeReaderValue<T>>(r, branch.c_str()));
+      }
+   }
+};
+
+// The actions on the same branch of the same node, e.g. Min, Max, Mean and Histo
+// of one variable: filters are checked and the value is read once per entry,
+// then all actions are called in turn with it.
+template <typename T, typename PrevDataFrame>
+class TDataFrameFusedAction final : public TDataFrameActionBase {
+   using Action_t = std::function<void(unsigned int, const T &)>;
+
+   std::vector<Action_t> fActions;
+   const BranchVec fBranches;
+   const BranchVec fTmpBranches;
+   PrevDataFrame *fPrevData;
+   std::weak_ptr<Details::TDataFrameImpl> fFirstData;
+   const unsigned int fGraphId;
+   std::vector<TVBVec_t> fReaderValues;
+   std::vector<TNodeSlotStats> fStats;
+   TSlotProfiler *fProfilers = nullptr; // null unless profiling
+
+public:
+   TDataFrameFusedAction(const std::string &branchName, std::weak_ptr<PrevDataFrame> pd)
+      : fBranches({branchName}), fTmpBranches(pd.lock()->GetTmpBranches()), fPrevData(pd.lock().get()),
+        fFirstData(pd.lock()->GetDataFrame()), fGraphId(pd.lock()->GetDataFrame().lock()->NewGraphId()) { }
+
+   TDataFrameFusedAction(const TDataFrameFusedAction &) = delete;
+
+   bool IsOn(const std::string &branchName, const PrevDataFrame *pd) const
+   {
+      return pd == fPrevData && branchName == fBranches[0];
+   }
+
+   void AddAction(Action_t action) { fActions.emplace_back(std::move(action)); }
+
+   void Run(unsigned int slot, int entry)
+   {
+      if (!fPrevData->CheckFilters(slot, entry)) return;
+      ++fStats[slot].fAll;
+      const TProfiledRegion region(fProfilers ? &fProfilers[slot] : nullptr, fStats[slot].fTime);
+      const T &value = GetBranchValue<0, T>(fReaderValues[slot][0], slot, entry, fBranches[0], fFirstData);
+      for (auto &action : fActions) action(slot, value);
+   }
+
+   void CreateSlots(unsigned int nSlots)
+   {
+      fReaderValues.resize(nSlots);
+      fStats.resize(nSlots);
+      fProfilers = fPrevData->GetDataFrame().lock()->GetSlotProfilers();
+   }
+
+   void BuildReaderValues(TTreeReader &r, unsigned int slot)
+   {
+      fReaderValues[slot] = ROOT::Internal::BuildReaderValues(r, fBranches, fTmpBranches, TDFTraitsUtils::TTypeList<T>(),
+                                                              TDFTraitsUtils::TStaticSeq<0>());
+   }
+
+   TGraphNode GetGraphNode() const
+   {
+      const auto label = fActions.size() == 1 ? std::string("Action(") : std::to_string(fActions.size()) + " actions(";
+      TGraphNode node("Action", label + fBranches[0] + ")", fGraphId, fPrevData->GetGraphId());
+      node.AddStats(fStats, fProfilers);
+      return node;
+   }
+};
+
 namespace Operations {
 using namespace Internal::TDFTraitsUtils;
 using Count_t = unsigned long;
@@ -407,106 +1155,1145 @@ public:
    }
 };
 
-class FillOperation {
-   // this sets a total initial size of 16 MB for the buffers (can increase)
-   static constexpr unsigned int fgTotalBufSize = 2097152;
-   using BufEl_t = double;
-   using Buf_t = std::vector<BufEl_t>;
-
-   std::vector<Buf_t> fBuffers;
-   std::shared_ptr<TH1F> fResultHist;
-   unsigned int fBufSize;
-   Buf_t fMin;
-   Buf_t fMax;
+// Sorted runs of values written to a temporary file, when the partial results
+// of an action do not fit in its memory budget. The file is deleted when closed.
+// Values are written as raw bytes: T must be trivially copyable.
+template <typename T>
+class TSpillFile {
+   struct TRun {
+      std::size_t fBegin; // position in the file, in number of values
+      std::size_t fSize;
+   };
+   std::unique_ptr<std::FILE, int (*)(std::FILE *)> fFile{nullptr, &std::fclose};
+   std::vector<TRun> fRuns;
+   std::size_t fSize = 0;
+   std::mutex fReadMutex; // runs are read concurrently while merging them
 
-   template <typename T>
-   void UpdateMinMax(unsigned int slot, T v) {
-      auto& thisMin = fMin[slot];
-      auto& thisMax = fMax[slot];
-      thisMin = std::min(thisMin, (BufEl_t)v);
-      thisMax = std::max(thisMax, (BufEl_t)v);
+   // std::fseek takes a long, which has 32 bits on Windows: spill files can be much larger
+   void Seek(std::size_t offset, int origin)
+   {
+#ifdef _WIN32
+      const bool ok = offset <= std::size_t(std::numeric_limits<__int64>::max()) &&
+                      _fseeki64(fFile.get(), __int64(offset), origin) == 0;
+#else
+      const bool ok = offset <= std::size_t(std::numeric_limits<off_t>::max()) &&
+                      fseeko(fFile.get(), off_t(offset), origin) == 0;
+#endif
+      if (!ok) throw std::runtime_error("Cannot seek in a temporary file holding the partial results of an action.");
    }
 
 public:
-   FillOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fResultHist(h),
-                                                                 fBufSize (fgTotalBufSize / nSlots),
-                                                                 fMin(nSlots, std::numeric_limits<BufEl_t>::max()),
-                                                                 fMax(nSlots, std::numeric_limits<BufEl_t>::min())
+   // Write the values of a range as a new run
+   template <typename It>
+   void WriteRun(It begin, It end)
    {
-      fBuffers.reserve(nSlots);
-      for (unsigned int i=0; i<nSlots; ++i) {
-         Buf_t v;
-         v.reserve(fBufSize);
-         fBuffers.emplace_back(v);
+      if (begin == end) return;
+      if (!fFile) fFile.reset(std::tmpfile());
+      if (!fFile) throw std::runtime_error("Cannot create a temporary file to spill the partial results of an action.");
+      Seek(0, SEEK_END);
+      // values are copied to a plain array first: e.g. std::vector<bool> does not store them contiguously
+      const std::size_t bufSize = 4096;
+      std::unique_ptr<T[]> buf(new T[bufSize]);
+      std::size_t runSize = 0;
+      while (begin != end) {
+         std::size_t n = 0;
+         for (; n < bufSize && begin != end; ++n, ++begin) buf[n] = *begin;
+         if (std::fwrite(buf.get(), sizeof(T), n, fFile.get()) != n)
+            throw std::runtime_error("Cannot write the partial results of an action to a temporary file.");
+         runSize += n;
       }
+      fRuns.push_back({fSize, runSize});
+      fSize += runSize;
    }
 
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
+   std::size_t GetNRuns() const { return fRuns.size(); }
+   std::size_t GetSize() const { return fSize; }
+   std::size_t GetRunSize(std::size_t run) const { return fRuns[run].fSize; }
+
+   // Read n values of a run, starting from its pos-th value
+   void Read(std::size_t run, std::size_t pos, T *values, std::size_t n)
    {
-      UpdateMinMax(slot, v);
-      fBuffers[slot].emplace_back(v);
+      std::lock_guard<std::mutex> lock(fReadMutex);
+      Seek((fRuns[run].fBegin + pos) * sizeof(T), SEEK_SET);
+      if (std::fread(values, sizeof(T), n, fFile.get()) != n)
+         throw std::runtime_error("Cannot read the partial results of an action from a temporary file.");
+   }
+};
+
+// Splits sorted runs in nPieces pieces of consecutive values, at splitters
+// sampled from the runs, so that the pieces can be merged independently.
+// get(r, i) returns the i-th value of run r. On return, bounds[p][r] is the
+// position in run r of the first value of piece p (bounds[nPieces][r] is the
+// size of run r), and offsets[p] the position of the first value of piece p in
+// the merged sequence. Values equal to a splitter all fall in the same piece.
+template <typename T, typename Compare, typename Get>
+void SplitSortedRuns(const std::vector<std::size_t> &runSizes, Compare compare, unsigned int nPieces, Get get,
+                     std::vector<std::vector<std::size_t>> &bounds, std::vector<std::size_t> &offsets)
+{
+   const auto nRuns = runSizes.size();
+   std::size_t totSize = 0;
+   for (auto size : runSizes) totSize += size;
+   // about 32 samples per piece, taken from each run in proportion to its size
+   std::vector<T> samples;
+   const std::size_t stride = std::max<std::size_t>(1, totSize / (32 * nPieces));
+   for (std::size_t r = 0; r < nRuns; ++r)
+      for (std::size_t i = stride / 2; i < runSizes[r]; i += stride) samples.emplace_back(get(r, i));
+   std::sort(samples.begin(), samples.end(), compare);
+
+   auto lowerBound = [&](std::size_t r, const T &v) {
+      std::size_t lo = 0, hi = runSizes[r];
+      while (lo < hi) {
+         const auto mid = lo + (hi - lo) / 2;
+         if (compare(get(r, mid), v))
+            lo = mid + 1;
+         else
+            hi = mid;
+      }
+      return lo;
+   };
+   bounds.assign(nPieces + 1, std::vector<std::size_t>(nRuns, 0));
+   bounds[nPieces] = runSizes;
+   for (unsigned int p = 1; p < nPieces; ++p) {
+      if (samples.empty()) {
+         bounds[p] = runSizes;
+         continue;
+      }
+      const auto &splitter = samples[p * samples.size() / nPieces];
+      for (std::size_t r = 0; r < nRuns; ++r) bounds[p][r] = lowerBound(r, splitter);
+   }
+   offsets.assign(nPieces + 1, 0);
+   for (unsigned int p = 0; p < nPieces; ++p) {
+      offsets[p + 1] = offsets[p];
+      for (std::size_t r = 0; r < nRuns; ++r) offsets[p + 1] += bounds[p + 1][r] - bounds[p][r];
+   }
+}
+
+// Moves the values of sorted ranges, given as (begin, end) pairs, to out in the
+// order defined by compare, with a k-way merge driven by a heap of their heads
+template <typename It, typename Compare, typename Out>
+void MergeSortedRanges(std::vector<std::pair<It, It>> &heads, Compare compare, Out out)
+{
+   using Head_t = std::pair<It, It>;
+   heads.erase(std::remove_if(heads.begin(), heads.end(), [](const Head_t &h) { return h.first == h.second; }),
+               heads.end());
+   // the heap keeps the range with the smallest current value on top
+   auto later = [&compare](const Head_t &a, const Head_t &b) { return compare(*b.first, *a.first); };
+   std::make_heap(heads.begin(), heads.end(), later);
+   while (heads.size() > 1) {
+      std::pop_heap(heads.begin(), heads.end(), later);
+      auto &head = heads.back();
+      *out = std::move(*head.first);
+      ++out;
+      if (++head.first == head.second)
+         heads.pop_back();
+      else
+         std::push_heap(heads.begin(), heads.end(), later);
+   }
+   if (!heads.empty()) std::move(heads.front().first, heads.front().second, out);
+}
+
+// Calls f(piece, pos, v) on all values v of all runs of the files, pos being the
+// position of v in the order defined by compare (runs must be sorted accordingly).
+// The runs are split in nPieces pieces of consecutive values, merged as separate
+// tasks: the calls for a piece come in order, from a single thread. Runs are
+// read in chunks, so memory does not depend on their size.
+template <typename T, typename Compare, typename F>
+void MergeSpilledRuns(std::vector<TSpillFile<T>> &files, Compare compare, unsigned int nPieces, F f)
+{
+   struct TCursor {
+      TSpillFile<T> *fFile;
+      std::size_t fRun;
+      std::size_t fNextPos; // in the run, of the first value not read yet
+      std::size_t fEnd;
+      std::size_t fBufCapacity;
+      std::unique_ptr<T[]> fBuf{new T[fBufCapacity]};
+      std::size_t fBufSize = 0;
+      std::size_t fBufPos = 0;
+      TCursor(TSpillFile<T> *file, std::size_t run, std::size_t begin, std::size_t end)
+         : fFile(file), fRun(run), fNextPos(begin), fEnd(end), fBufCapacity(std::min<std::size_t>(4096, end - begin))
+      {
+         Next();
+      }
+      const T &Get() const { return fBuf[fBufPos]; }
+      // move to the next value, false if the range is over
+      bool Next()
+      {
+         if (++fBufPos < fBufSize) return true;
+         const auto n = std::min(fBufCapacity, fEnd - fNextPos);
+         if (n == 0) return false;
+         fFile->Read(fRun, fNextPos, fBuf.get(), n);
+         fNextPos += n;
+         fBufSize = n;
+         fBufPos = 0;
+         return true;
+      }
+   };
+   std::vector<std::pair<TSpillFile<T> *, std::size_t>> runs; // file, run
+   std::vector<std::size_t> runSizes;
+   for (auto &file : files) {
+      for (std::size_t run = 0; run < file.GetNRuns(); ++run) {
+         runs.emplace_back(&file, run);
+         runSizes.emplace_back(file.GetRunSize(run));
+      }
+   }
+   auto get = [&runs](std::size_t r, std::size_t pos) {
+      T v;
+      runs[r].first->Read(runs[r].second, pos, &v, 1);
+      return v;
+   };
+   std::vector<std::vector<std::size_t>> bounds;
+   std::vector<std::size_t> offsets;
+   SplitSortedRuns<T>(runSizes, compare, nPieces, get, bounds, offsets);
+
+   ParallelFor(nPieces, [&](unsigned int piece) {
+      std::vector<std::unique_ptr<TCursor>> cursors;
+      for (std::size_t r = 0; r < runs.size(); ++r)
+         if (bounds[piece][r] < bounds[piece + 1][r])
+            cursors.emplace_back(new TCursor(runs[r].first, runs[r].second, bounds[piece][r], bounds[piece + 1][r]));
+      // the heap keeps the cursor with the smallest current value on top
+      auto later = [&cursors, &compare](std::size_t a, std::size_t b) {
+         return compare(cursors[b]->Get(), cursors[a]->Get());
+      };
+      std::vector<std::size_t> heap(cursors.size());
+      for (std::size_t i = 0; i < heap.size(); ++i) heap[i] = i;
+      std::make_heap(heap.begin(), heap.end(), later);
+      auto pos = offsets[piece];
+      while (!heap.empty()) {
+         std::pop_heap(heap.begin(), heap.end(), later);
+         auto &cursor = *cursors[heap.back()];
+         f(piece, pos++, cursor.Get());
+         if (cursor.Next())
+            std::push_heap(heap.begin(), heap.end(), later);
+         else
+            heap.pop_back();
+      }
+   });
+}
+
+// Scrambles the bits of a (possibly poor, e.g. identity) hash: MurmurHash3's finalizer
+ULong64_t MixHash(ULong64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 33;
+   return h;
+}
+
+// Counts distinct values exactly: every slot collects the values it sees in hash
+// sets, one per bucket of hash values. At the end of the event loop each bucket
+// is merged across slots as a separate task, into the largest of its sets, and
+// the sizes of the merged buckets are summed. If the sets of a slot take more
+// than its share of the memory budget, their values are written sorted to a
+// temporary file and the sets are emptied; distinct values are then counted
+// while merging the sorted runs.
+template <typename T>
+class CountDistinctOperation {
+   ULong64_t *fResultCount;
+   const unsigned int fNBuckets;
+   std::vector<std::vector<std::unordered_set<T>>> fBuckets; // per slot, allocated on first use
+   std::vector<std::size_t> fSizes;                          // per slot, of all its buckets
+   std::size_t fMaxSetSize;                                  // per slot, before spilling
+   std::vector<TSpillFile<T>> fSpillFiles;
+
+   unsigned int GetBucket(const T &v) const { return fNBuckets == 1 ? 0 : MixHash(std::hash<T>()(v)) % fNBuckets; }
+
+   void Spill(unsigned int slot)
+   {
+      std::vector<T> values;
+      values.reserve(fSizes[slot]);
+      for (auto &set : fBuckets[slot]) {
+         values.insert(values.end(), set.begin(), set.end());
+         std::unordered_set<T>().swap(set);
+      }
+      std::sort(values.begin(), values.end());
+      fSpillFiles[slot].WriteRun(values.begin(), values.end());
+      fSizes[slot] = 0;
+   }
+
+public:
+   CountDistinctOperation(ULong64_t *resultCount, ULong64_t memoryBudget, unsigned int nSlots)
+      : fResultCount(resultCount), fNBuckets(nSlots), fBuckets(nSlots), fSizes(nSlots, 0),
+        fMaxSetSize(std::numeric_limits<std::size_t>::max()), fSpillFiles(nSlots)
+   {
+      // a rough estimate of the memory taken by an element of a hash set: value, next pointer, hash, bucket
+      const std::size_t elementSize = sizeof(T) + 3 * sizeof(void *);
+      if (memoryBudget > 0 && std::is_trivially_copyable<T>::value)
+         fMaxSetSize = std::max<std::size_t>(1, memoryBudget / nSlots / elementSize);
+   }
+
+   void Exec(const T &v, unsigned int slot)
+   {
+      auto &buckets = fBuckets[slot];
+      if (buckets.empty()) buckets.resize(fNBuckets);
+      if (buckets[GetBucket(v)].insert(v).second && ++fSizes[slot] >= fMaxSetSize) Spill(slot);
+   }
+
+   template <typename Coll, typename std::enable_if<TIsContainer<Coll>::fgValue, int>::type = 0>
+   void Exec(const Coll &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) Exec(v, slot);
+   }
+
+   ~CountDistinctOperation()
+   {
+      auto isSpilled = [](const TSpillFile<T> &f) { return f.GetNRuns() > 0; };
+      if (std::any_of(fSpillFiles.begin(), fSpillFiles.end(), isSpilled)) {
+         ParallelFor(fBuckets.size(), [this](unsigned int slot) { Spill(slot); });
+         // equal values fall in the same piece of the merge: pieces are counted separately
+         const unsigned int nPieces = fSpillFiles.size();
+         std::vector<ULong64_t> counts(nPieces, 0);
+         std::unique_ptr<T[]> lasts(new T[nPieces]); // not a std::vector, which packs bools
+         MergeSpilledRuns(fSpillFiles, std::less<T>(), nPieces, [&](unsigned int piece, std::size_t, const T &v) {
+            // values come sorted: a value is new if it is larger than the previous one
+            if (counts[piece] == 0 || lasts[piece] < v) ++counts[piece];
+            lasts[piece] = v;
+         });
+         *fResultCount = 0;
+         for (auto count : counts) *fResultCount += count;
+         return;
+      }
+      // a value falls in the same bucket in all slots: buckets are disjoint
+      std::vector<ULong64_t> counts(fNBuckets, 0);
+      ParallelFor(fNBuckets, [this, &counts](unsigned int bucket) {
+         std::unordered_set<T> *largest = nullptr;
+         for (auto &buckets : fBuckets)
+            if (!buckets.empty() && (!largest || buckets[bucket].size() > largest->size())) largest = &buckets[bucket];
+         if (!largest) return;
+         for (auto &buckets : fBuckets)
+            if (!buckets.empty() && &buckets[bucket] != largest)
+               largest->insert(buckets[bucket].begin(), buckets[bucket].end());
+         counts[bucket] = largest->size();
+      });
+      *fResultCount = 0;
+      for (auto count : counts) *fResultCount += count;
+   }
+};
+
+// Estimates the number of distinct values with HyperLogLog (P. Flajolet et al.,
+// 2007): each value is hashed, the first `precision` bits of the hash select one of
+// 2^precision registers, which keeps the maximum position of the first set bit in
+// the rest of the hash. Registers of different slots are merged by taking the
+// maximum, which gives exactly the registers of a single-threaded run.
+// The relative standard error of the estimate is 1.04 / sqrt(2^precision).
+template <typename T>
+class CountDistinctHLLOperation {
+   ULong64_t *fResultCount;
+   unsigned int fPrecision;
+   std::vector<std::vector<unsigned char>> fRegisters; // per slot, allocated on first use
+
+   std::vector<unsigned char> &GetSlotRegisters(unsigned int slot)
+   {
+      auto &regs = fRegisters[slot];
+      if (regs.empty()) regs.resize(1u << fPrecision, 0);
+      return regs;
+   }
+
+   void Add(std::vector<unsigned char> &regs, const T &v)
+   {
+      const ULong64_t h = MixHash(std::hash<T>()(v));
+      const auto index = h >> (64 - fPrecision);
+      // the bit set after the remaining 64 - precision bits bounds the number of zeros
+      ULong64_t rest = (h << fPrecision) | (1ULL << (fPrecision - 1));
+      unsigned char rank = 1;
+      while (!(rest & (1ULL << 63))) {
+         rest <<= 1;
+         ++rank;
+      }
+      if (rank > regs[index]) regs[index] = rank;
+   }
+
+public:
+   CountDistinctHLLOperation(ULong64_t *resultCount, unsigned int precision, unsigned int nSlots)
+      : fResultCount(resultCount), fPrecision(precision), fRegisters(nSlots) {}
+
+   void Exec(const T &v, unsigned int slot) { Add(GetSlotRegisters(slot), v); }
+
+   template <typename Coll, typename std::enable_if<TIsContainer<Coll>::fgValue, int>::type = 0>
+   void Exec(const Coll &vs, unsigned int slot)
+   {
+      auto &regs = GetSlotRegisters(slot);
+      for (auto &&v : vs) Add(regs, v);
+   }
+
+   ~CountDistinctHLLOperation()
+   {
+      const unsigned int m = 1u << fPrecision;
+      std::vector<unsigned char> regs(m, 0);
+      for (auto &slotRegs : fRegisters)
+         for (unsigned int i = 0; i < slotRegs.size(); ++i) regs[i] = std::max(regs[i], slotRegs[i]);
+      double invSum = 0.;
+      unsigned int nZeros = 0;
+      for (auto r : regs) {
+         invSum += std::ldexp(1., -r);
+         if (r == 0) ++nZeros;
+      }
+      const double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1. + 1.079 / m);
+      double estimate = alpha * m * m / invSum;
+      // for small cardinalities, linear counting of the empty registers is more accurate
+      if (estimate <= 2.5 * m && nZeros > 0) estimate = m * std::log(double(m) / nZeros);
+      *fResultCount = ULong64_t(estimate + 0.5);
+   }
+};
+
+// Stands in for an iterator over weights when all values have the same weight
+class TConstWeight {
+   double fW;
+
+public:
+   TConstWeight(double w) : fW(w) {}
+   double operator*() const { return fW; }
+   TConstWeight operator++(int) { return *this; }
+};
+
+// Compute the bins of size values on a uniform axis, with the same result as
+// TAxis::FindFixBin, NaNs included. The loop can be vectorised: the position on
+// the axis is clamped only to make its conversion to int well defined.
+void FindUniformBins(const double *x, int *bins, std::size_t size, int nBins, double xMin, double xMax)
+{
+   const double width = xMax - xMin;
+   const double maxPos = nBins;
+   for (std::size_t i = 0; i < size; ++i) {
+      double pos = nBins * (x[i] - xMin) / width;
+      pos = pos < maxPos ? pos : maxPos;
+      pos = pos > 0. ? pos : 0.;
+      bins[i] = x[i] < xMin ? 0 : x[i] < xMax ? 1 + int(pos) : nBins + 1;
+   }
+}
+
+// Add the statistics of size weighted values to stats, in the layout of
+// TH1::GetStats: sum of weights, sum of squared weights, sum of w*x, sum of w*x*x.
+// As in TH1::Fill, values in the under and overflow bins are not considered.
+void AddStats(double *stats, const double *x, const double *w, const int *bins, std::size_t size, int nBins)
+{
+   for (std::size_t i = 0; i < size; ++i) {
+      const double inRangeW = bins[i] > 0 && bins[i] <= nBins ? w[i] : 0.;
+      stats[0] += inRangeW;
+      stats[1] += inRangeW * w[i];
+      stats[2] += inRangeW * x[i];
+      stats[3] += inRangeW * x[i] * x[i];
+   }
+}
+
+// Fill a histogram with n values (and weights) read from iterators. For uniform
+// axes the bins of a batch of values are computed in a loop that the compiler
+// can vectorise, and the bin contents and statistics are then updated in a
+// second loop, skipping TH1::Fill altogether. Histograms with variable bins or
+// an internal buffer, as well as batches that would require extending the axis,
+// go through TH1::Fill.
+template <typename XIt, typename WIt>
+void FillBatched(TH1 &h, std::size_t n, XIt xs, WIt ws)
+{
+   auto xaxis = h.GetXaxis();
+   if (h.GetDimension() != 1 || xaxis->GetXbins()->fN || h.GetBufferSize() || TH1::StatOverflows()) {
+      for (std::size_t i = 0; i < n; ++i)
+         h.Fill((double)*(xs++), (double)*(ws++));
+      return;
+   }
+
+   constexpr std::size_t batchSize = 64;
+   double x[batchSize];
+   double w[batchSize];
+   int bins[batchSize];
+   double stats[4]; // sum of weights, sum of squared weights, sum of w*x, sum of w*x*x
+   for (std::size_t first = 0; first < n; first += batchSize) {
+      const std::size_t size = std::min(batchSize, n - first);
+      bool unitWeights = true;
+      for (std::size_t i = 0; i < size; ++i) {
+         x[i] = *(xs++);
+         w[i] = *(ws++);
+         unitWeights &= w[i] == 1.;
+      }
+
+      // the axis might have been extended by the previous batch
+      const int nBins = xaxis->GetNbins();
+      const double xMin = xaxis->GetXmin();
+      const double xMax = xaxis->GetXmax();
+      if (h.CanExtendAllAxes() && !std::all_of(x, x + size, [=](double v) { return v >= xMin && v < xMax; })) {
+         for (std::size_t i = 0; i < size; ++i)
+            h.Fill(x[i], w[i]);
+         continue;
+      }
+
+      FindUniformBins(x, bins, size, nBins, xMin, xMax);
+      if (!unitWeights && !h.GetSumw2N() && !h.TestBit(TH1::kIsNotW)) h.Sumw2();
+      h.GetStats(stats);
+      auto sumw2 = h.GetSumw2N() ? h.GetSumw2()->fArray : nullptr;
+      for (std::size_t i = 0; i < size; ++i) {
+         h.AddBinContent(bins[i], w[i]);
+         if (sumw2) sumw2[bins[i]] += w[i] * w[i];
+      }
+      AddStats(stats, x, w, bins, size, nBins);
+      h.PutStats(stats);
+      h.SetEntries(h.GetEntries() + size);
+   }
+}
+
+template <typename XIt>
+void FillBatched(TH1 &h, std::size_t n, XIt xs)
+{
+   FillBatched(h, n, xs, TConstWeight(1.));
+}
+
+// Copy of the bins of a TAxis, which finds bins as TAxis::FindFixBin does
+class TLightAxis {
+   std::vector<double> fEdges; // empty if the axis is uniform
+   int fNBins;
+   double fMin;
+   double fMax;
+
+public:
+   explicit TLightAxis(const TAxis &axis)
+      : fEdges(axis.GetXbins()->fArray, axis.GetXbins()->fArray + axis.GetXbins()->fN), fNBins(axis.GetNbins()),
+        fMin(axis.GetXmin()), fMax(axis.GetXmax())
+   {
+   }
+
+   int GetNBins() const { return fNBins; }
+   double GetMin() const { return fMin; }
+   double GetMax() const { return fMax; }
+   bool IsUniform() const { return fEdges.empty(); }
+
+   int FindBin(double x) const
+   {
+      if (x < fMin) return 0;
+      if (!(x < fMax)) return fNBins + 1;
+      if (fEdges.empty()) return 1 + int(fNBins * (x - fMin) / (fMax - fMin));
+      return std::upper_bound(fEdges.begin(), fEdges.end(), x) - fEdges.begin();
+   }
+};
+
+// Minimal one-dimensional histogram with fixed (uniform or variable) bins, used
+// to fill a histogram from a single slot. It is not a TObject and bin contents,
+// sums of squared weights and statistics are plain data members: filling does
+// no virtual calls, and adding two of them is a sum of arrays. T is the type of
+// the bin contents, e.g. float to fill a TH1F. Sums of squared weights are only
+// stored after the first fill with a weight different from 1.
+template <typename T>
+class TLightHisto1D {
+   TLightAxis fAxis;
+   std::vector<T> fContent;     // one element per bin, under and overflow included
+   std::vector<double> fSumw2;  // empty if all weights were 1
+   double fStats[4] = {0., 0., 0., 0.}; // see AddStats
+   double fEntries = 0.;
+
+   void Sumw2()
+   {
+      fSumw2.assign(fContent.begin(), fContent.end());
+   }
+
+public:
+   /// Build an empty histogram with the same axis as h
+   explicit TLightHisto1D(const TH1 &h) : fAxis(*h.GetXaxis()), fContent(h.GetNbinsX() + 2) {}
+
+   /// Return true if filling this class and adding it to h is equivalent to filling h
+   static bool CanFill(const TH1 &h)
+   {
+      return h.GetDimension() == 1 && !h.CanExtendAllAxes() && !h.GetBufferSize() && !TH1::StatOverflows();
+   }
+
+   void Fill(double x, double w = 1.)
+   {
+      const int bin = fAxis.FindBin(x);
+      if (w != 1. && fSumw2.empty()) Sumw2();
+      fContent[bin] += w;
+      if (!fSumw2.empty()) fSumw2[bin] += w * w;
+      fEntries += 1;
+      if (bin > 0 && bin <= fAxis.GetNBins()) {
+         fStats[0] += w;
+         fStats[1] += w * w;
+         fStats[2] += w * x;
+         fStats[3] += w * x * x;
+      }
+   }
+
+   /// Fill with n values and weights read from iterators. Bins are computed in
+   /// batches, in a vectorisable loop if the axis is uniform.
+   template <typename XIt, typename WIt>
+   void FillN(std::size_t n, XIt xs, WIt ws)
+   {
+      constexpr std::size_t batchSize = 64;
+      double x[batchSize];
+      double w[batchSize];
+      int bins[batchSize];
+      for (std::size_t first = 0; first < n; first += batchSize) {
+         const std::size_t size = std::min(batchSize, n - first);
+         bool unitWeights = true;
+         for (std::size_t i = 0; i < size; ++i) {
+            x[i] = *(xs++);
+            w[i] = *(ws++);
+            unitWeights &= w[i] == 1.;
+         }
+         if (fAxis.IsUniform()) {
+            FindUniformBins(x, bins, size, fAxis.GetNBins(), fAxis.GetMin(), fAxis.GetMax());
+         } else {
+            for (std::size_t i = 0; i < size; ++i)
+               bins[i] = fAxis.FindBin(x[i]);
+         }
+         if (!unitWeights && fSumw2.empty()) Sumw2();
+         for (std::size_t i = 0; i < size; ++i)
+            fContent[bins[i]] += w[i];
+         if (!fSumw2.empty()) {
+            for (std::size_t i = 0; i < size; ++i)
+               fSumw2[bins[i]] += w[i] * w[i];
+         }
+         AddStats(fStats, x, w, bins, size, fAxis.GetNBins());
+         fEntries += size;
+      }
+   }
+
+   /// Add the contents of other, which must have the same axis
+   void Add(const TLightHisto1D &other)
+   {
+      if (!other.fSumw2.empty() && fSumw2.empty()) Sumw2();
+      for (std::size_t b = 0; b < fContent.size(); ++b) {
+         fContent[b] += other.fContent[b];
+         if (!fSumw2.empty()) fSumw2[b] += other.fSumw2.empty() ? other.fContent[b] : other.fSumw2[b];
+      }
+      for (int i = 0; i < 4; ++i)
+         fStats[i] += other.fStats[i];
+      fEntries += other.fEntries;
+   }
+
+   /// Add bin contents, sums of squared weights and statistics to h, which must
+   /// have the same axis
+   void AddTo(TH1 &h) const
+   {
+      double stats[4];
+      h.GetStats(stats);
+      for (int i = 0; i < 4; ++i)
+         stats[i] += fStats[i];
+      if (!fSumw2.empty() && !h.GetSumw2N()) h.Sumw2();
+      auto sumw2 = h.GetSumw2N() ? h.GetSumw2()->fArray : nullptr;
+      for (std::size_t b = 0; b < fContent.size(); ++b) {
+         h.AddBinContent(b, fContent[b]);
+         if (sumw2) sumw2[b] += fSumw2.empty() ? fContent[b] : fSumw2[b];
+      }
+      h.PutStats(stats);
+      h.SetEntries(h.GetEntries() + fEntries);
+   }
+};
+
+// Histogram with fixed bins, in up to three dimensions, filled concurrently by
+// all slots. Bin contents and sums of squared weights are atomics, so that a
+// single copy of the bins is needed whatever the number of slots. Statistics
+// and numbers of entries are not shared: each slot keeps its own.
+class TAtomicHisto {
+   struct TSlotStats {
+      // in the layout of TH1::GetStats, TH2::GetStats or TH3::GetStats
+      std::array<double, 11> fStats;
+      double fEntries;
+      bool fHasWeights;
+      // the size of the struct is 128 bytes, to reduce false sharing between slots
+      char fPadding[128 - 12 * sizeof(double) - sizeof(bool)];
+   };
+
+   std::vector<TLightAxis> fAxes;
+   std::vector<std::atomic<double>> fContent; // same bin numbering as TH1::GetBin
+   std::vector<std::atomic<double>> fSumw2;   // empty if the histogram is not weighted
+   std::vector<TSlotStats> fSlotStats;
+
+   static void AtomicAdd(std::atomic<double> &a, double v)
+   {
+      auto old = a.load(std::memory_order_relaxed);
+      while (!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {
+      }
+   }
+
+public:
+   /// Build an empty histogram with the same axes as h. Sums of squared weights
+   /// are only stored if isWeighted is true.
+   TAtomicHisto(const TH1 &h, bool isWeighted, unsigned int nSlots)
+      : fContent(h.GetNcells()), fSumw2(isWeighted ? h.GetNcells() : 0), fSlotStats(nSlots)
+   {
+      const TAxis *axes[] = {h.GetXaxis(), h.GetYaxis(), h.GetZaxis()};
+      for (int i = 0; i < h.GetDimension(); ++i)
+         fAxes.emplace_back(*axes[i]);
+      for (auto &slotStats : fSlotStats) {
+         slotStats.fStats.fill(0.);
+         slotStats.fEntries = 0.;
+         slotStats.fHasWeights = false;
+      }
+   }
+
+   /// Return true if filling this class and adding it to h is equivalent to filling h
+   static bool CanFill(const TH1 &h)
+   {
+      if (dynamic_cast<const TProfile *>(&h) || dynamic_cast<const TProfile2D *>(&h)) return false;
+      const TAxis *axes[] = {h.GetXaxis(), h.GetYaxis(), h.GetZaxis()};
+      for (int i = 0; i < h.GetDimension(); ++i) {
+         if (axes[i]->CanExtend()) return false;
+      }
+      return h.GetDimension() <= 3 && !h.GetBufferSize() && !TH1::StatOverflows();
+   }
+
+   unsigned int GetDimension() const { return fAxes.size(); }
+
+   /// Fill with the coordinates x, as many as the dimensions of the histogram, and weight w
+   void Fill(unsigned int slot, const double *x, double w)
+   {
+      std::size_t bin = 0;
+      std::size_t stride = 1;
+      bool isInRange = true;
+      for (unsigned int i = 0; i < fAxes.size(); ++i) {
+         const int axisBin = fAxes[i].FindBin(x[i]);
+         isInRange &= axisBin > 0 && axisBin <= fAxes[i].GetNBins();
+         bin += axisBin * stride;
+         stride *= fAxes[i].GetNBins() + 2;
+      }
+      AtomicAdd(fContent[bin], w);
+      if (!fSumw2.empty()) AtomicAdd(fSumw2[bin], w * w);
+
+      auto &slotStats = fSlotStats[slot];
+      slotStats.fEntries += 1;
+      slotStats.fHasWeights |= w != 1.;
+      if (!isInRange) return;
+      auto &s = slotStats.fStats;
+      s[0] += w;
+      s[1] += w * w;
+      s[2] += w * x[0];
+      s[3] += w * x[0] * x[0];
+      if (fAxes.size() > 1) {
+         s[4] += w * x[1];
+         s[5] += w * x[1] * x[1];
+         s[6] += w * x[0] * x[1];
+      }
+      if (fAxes.size() > 2) {
+         s[7] += w * x[2];
+         s[8] += w * x[2] * x[2];
+         s[9] += w * x[0] * x[2];
+         s[10] += w * x[1] * x[2];
+      }
+   }
+
+   /// Add bin contents, sums of squared weights and statistics to h, which must
+   /// have the same axes. Must not be called while the histogram is being filled.
+   void AddTo(TH1 &h) const
+   {
+      std::array<double, 11> stats;
+      stats.fill(0.);
+      h.GetStats(stats.data());
+      double entries = h.GetEntries();
+      bool hasWeights = false;
+      for (auto &slotStats : fSlotStats) {
+         for (std::size_t i = 0; i < stats.size(); ++i)
+            stats[i] += slotStats.fStats[i];
+         entries += slotStats.fEntries;
+         hasWeights |= slotStats.fHasWeights;
+      }
+      if (hasWeights && !h.GetSumw2N()) h.Sumw2();
+      auto sumw2 = h.GetSumw2N() ? h.GetSumw2()->fArray : nullptr;
+      for (std::size_t b = 0; b < fContent.size(); ++b) {
+         const double content = fContent[b].load(std::memory_order_relaxed);
+         h.AddBinContent(b, content);
+         if (sumw2) sumw2[b] += fSumw2.empty() ? content : fSumw2[b].load(std::memory_order_relaxed);
+      }
+      h.PutStats(stats.data());
+      h.SetEntries(entries);
+   }
+};
+
+// A copy of a histogram made on any thread, attached to no directory. The copy
+// constructor of TH1 appends the copy to gDirectory, gROOT on the threads of the
+// pool: the copy is made with no current directory, under a lock.
+template <typename HIST>
+HIST *NewDetachedCopy(const HIST &h)
+{
+   static std::mutex mutex;
+   std::lock_guard<std::mutex> lock(mutex);
+   const TDirectory::TContext ctx(nullptr);
+   auto copy = new HIST(h);
+   copy->SetDirectory(nullptr);
+   return copy;
+}
+
+// Values (and weights, if any) are buffered until the axis limits of the histogram
+// can be decided. If the buffer of a slot fills up before the end of the event loop,
+// the axis is fixed on the basis of the minimum and maximum of the values buffered by
+// that slot. From then on each slot fills its own copy of the histogram, whose
+// axis is extended as needed, and the copies are merged at the end of the loop.
+// If no buffer fills up, the axis is decided using all values at the end of the loop.
+class FillOperation {
+   using BufEl_t = double;
+   using Buf_t = std::vector<BufEl_t>;
+
+   std::vector<Buf_t> fBuffers;
+   std::vector<Buf_t> fWBuffers; // stay empty if the histogram is not weighted
+   std::shared_ptr<TH1F> fResultHist;
+   unsigned int fBufSize;
+   Buf_t fMin;
+   Buf_t fMax;
+   std::vector<std::unique_ptr<TH1F>> fSlotHists;
+   std::atomic<bool> fAxisFixed;
+   std::mutex fAxisMutex;
+
+   template <typename T>
+   void UpdateMinMax(unsigned int slot, T v) {
+      auto& thisMin = fMin[slot];
+      auto& thisMax = fMax[slot];
+      thisMin = std::min(thisMin, (BufEl_t)v);
+      thisMax = std::max(thisMax, (BufEl_t)v);
+   }
+
+   void FillN(TH1F &h, unsigned int slot)
+   {
+      const auto &thisBuf = fBuffers[slot];
+      const auto &thisWBuf = fWBuffers[slot];
+      if (thisWBuf.empty())
+         FillBatched(h, thisBuf.size(), thisBuf.begin());
+      else
+         FillBatched(h, thisBuf.size(), thisBuf.begin(), thisWBuf.begin());
+   }
+
+   void FixAxis(unsigned int slot)
+   {
+      std::lock_guard<std::mutex> lock(fAxisMutex);
+      if (fAxisFixed) return;
+      auto xmin = fMin[slot];
+      auto xmax = fMax[slot];
+      // values equal to the upper edge of the axis would fall in the overflow bin
+      xmax += xmax > xmin ? (xmax - xmin) * 1e-6 : 1.;
+      fResultHist->SetBins(fResultHist->GetNbinsX(), xmin, xmax);
+      fAxisFixed = true;
+   }
+
+   // Return the histogram of the slot, or nullptr if the axis has not been fixed
+   // yet. The values buffered by the slot are flushed into its histogram when
+   // it is created.
+   TH1F *GetSlotHist(unsigned int slot)
+   {
+      auto &h = fSlotHists[slot];
+      if (!h && fAxisFixed) {
+         h.reset(NewDetachedCopy(*fResultHist));
+         FillN(*h, slot);
+         Buf_t().swap(fBuffers[slot]);
+         Buf_t().swap(fWBuffers[slot]);
+      }
+      return h.get();
+   }
+
+   void BufferWeight(unsigned int) {}
+
+   void BufferWeight(unsigned int slot, double w)
+   {
+      auto &thisWBuf = fWBuffers[slot];
+      if (thisWBuf.empty()) thisWBuf.reserve(fBufSize);
+      thisWBuf.emplace_back(w);
+   }
+
+   // w is either empty or a single weight
+   template <typename T, typename... W>
+   void Fill(unsigned int slot, T v, W... w)
+   {
+      if (auto h = GetSlotHist(slot)) {
+         h->Fill((BufEl_t)v, (double)w...);
+         return;
+      }
+      UpdateMinMax(slot, v);
+      auto &thisBuf = fBuffers[slot];
+      if (thisBuf.empty()) thisBuf.reserve(fBufSize);
+      thisBuf.emplace_back(v);
+      BufferWeight(slot, w...);
+      if (thisBuf.size() >= fBufSize) {
+         FixAxis(slot);
+         GetSlotHist(slot);
+      }
+   }
+
+   // ws is either empty or a single iterator over the weights
+   template <typename T, typename... WIt>
+   void FillCollection(unsigned int slot, const T &vs, WIt... ws)
+   {
+      auto xs = std::begin(vs);
+      const std::size_t n = vs.size();
+      if (auto h = GetSlotHist(slot)) {
+         FillBatched(*h, n, xs, ws...);
+         return;
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+         Fill(slot, *(xs++), *(ws++)...);
+      }
+   }
+
+public:
+   /// bufSize is the maximum number of buffered values, summed over all slots.
+   /// The buffer of a slot is allocated when the slot first uses it.
+   FillOperation(std::shared_ptr<TH1F> h, unsigned int bufSize, unsigned int nSlots)
+      : fBuffers(nSlots), fWBuffers(nSlots), fResultHist(h), fBufSize(std::max(bufSize / nSlots, 1U)),
+        fMin(nSlots, std::numeric_limits<BufEl_t>::max()), fMax(nSlots, std::numeric_limits<BufEl_t>::lowest()),
+        fSlotHists(nSlots), fAxisFixed(false)
+   {
+   }
+
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      Fill(slot, v);
    }
 
    template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
    void Exec(const T &vs, unsigned int slot)
    {
-      auto& thisBuf = fBuffers[slot];
-      for (auto& v : vs) {
-         UpdateMinMax(slot, v);
-         thisBuf.emplace_back(v); // TODO: Can be optimised in case T == BufEl_t
-      }
+      FillCollection(slot, vs);
+   }
+
+   template <typename T, typename W,
+             typename std::enable_if<!TIsContainer<T>::fgValue && !TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(T v, W w, unsigned int slot)
+   {
+      Fill(slot, v, w);
+   }
+
+   // each element of the collection has the same weight
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && !TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, W w, unsigned int slot)
+   {
+      FillCollection(slot, vs, TConstWeight(w));
+   }
+
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, const W &ws, unsigned int slot)
+   {
+      if (vs.size() != ws.size())
+         throw std::runtime_error("collections of values and weights used to fill a histogram must have the same size");
+      FillCollection(slot, vs, std::begin(ws));
    }
 
    ~FillOperation()
    {
+      if (fAxisFixed) {
+         TList slotHists;
+         for (unsigned int slot = 0; slot < fSlotHists.size(); ++slot) {
+            // skip slots that were never used
+            if (!fSlotHists[slot] && fBuffers[slot].empty()) continue;
+            slotHists.Add(GetSlotHist(slot));
+         }
+         fResultHist->Merge(&slotHists);
+         return;
+      }
 
       BufEl_t globalMin = *std::min_element(fMin.begin(), fMin.end());
       BufEl_t globalMax = *std::max_element(fMax.begin(), fMax.end());
 
       if (fResultHist->CanExtendAllAxes() &&
           globalMin != std::numeric_limits<BufEl_t>::max() &&
-          globalMax != std::numeric_limits<BufEl_t>::min()) {
+          globalMax != std::numeric_limits<BufEl_t>::lowest()) {
          auto xaxis = fResultHist->GetXaxis();
          fResultHist->ExtendAxis(globalMin, xaxis);
          fResultHist->ExtendAxis(globalMax, xaxis);
       }
 
-      for (auto& buf : fBuffers) {
-         Buf_t w(buf.size(),1); // A bug in FillN?
-         fResultHist->FillN(buf.size(), buf.data(),  w.data());
+      for (unsigned int slot = 0; slot < fBuffers.size(); ++slot) {
+         FillN(*fResultHist, slot);
+      }
+   }
+};
+
+
+// Each slot fills its own TLightHisto1D. At the end of the loop they are added
+// together and the sum is added to the result histogram. Used instead of
+// FillTOOperation<TH1F> when TLightHisto1D::CanFill the result histogram.
+class FillLightOperation {
+   using Hist_t = TLightHisto1D<float>;
+   std::shared_ptr<TH1F> fResultHist;
+   std::vector<std::unique_ptr<Hist_t>> fSlotHists; // created when the slot first uses it
+
+   Hist_t &GetSlotHist(unsigned int slot)
+   {
+      auto &h = fSlotHists[slot];
+      if (!h) h.reset(new Hist_t(*fResultHist));
+      return *h;
+   }
+
+public:
+   FillLightOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fResultHist(h), fSlotHists(nSlots) {}
+
+   // a value, or a value and a weight
+   template <typename... Ts, typename std::enable_if<TAllOf<!TIsContainer<Ts>::fgValue...>::value, int>::type = 0>
+   void Exec(const Ts &... vs, unsigned int slot)
+   {
+      GetSlotHist(slot).Fill(vs...);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      GetSlotHist(slot).FillN(vs.size(), std::begin(vs), TConstWeight(1.));
+   }
+
+   // each element of the collection has the same weight
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && !TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, const W &w, unsigned int slot)
+   {
+      GetSlotHist(slot).FillN(vs.size(), std::begin(vs), TConstWeight(w));
+   }
+
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, const W &ws, unsigned int slot)
+   {
+      if (vs.size() != ws.size())
+         throw std::runtime_error("collections used to fill a histogram must have the same size");
+      GetSlotHist(slot).FillN(vs.size(), std::begin(vs), std::begin(ws));
+   }
+
+   ~FillLightOperation()
+   {
+      Hist_t *sum = nullptr;
+      for (auto &h : fSlotHists) {
+         if (!h) continue;
+         if (sum)
+            sum->Add(*h);
+         else
+            sum = h.get();
       }
+      if (sum) sum->AddTo(*fResultHist);
    }
 };
 
+// Return true if the extra memory taken by one copy of the bins of h per slot,
+// besides h itself, is above threshold bytes, and the slots can share instead
+// a single TAtomicHisto
+bool UseSharedHisto(const TH1 &h, bool isWeighted, unsigned int nSlots, ULong64_t threshold)
+{
+   if (nSlots < 2 || !TAtomicHisto::CanFill(h)) return false;
+   // TH1F, TH2F and TH3F store bin contents as floats
+   const ULong64_t slotBytes = h.GetNcells() * (sizeof(float) + (isWeighted ? sizeof(double) : 0));
+   return (nSlots - 1) * slotBytes > threshold;
+}
+
+// All slots fill the same TAtomicHisto, which is added to the result histogram
+// at the end of the loop. The values of several branches are the coordinates,
+// optionally followed by a weight. Collections are iterated over together, and
+// a scalar following a collection is a weight that applies to all its elements.
+class FillSharedOperation {
+   std::shared_ptr<TH1> fResultHist;
+   TAtomicHisto fHist;
 
+   template <typename... Ts>
+   void FillValues(unsigned int slot, const Ts &... vs)
+   {
+      const double values[] = {double(vs)...};
+      fHist.Fill(slot, values, sizeof...(Ts) > fHist.GetDimension() ? values[fHist.GetDimension()] : 1.);
+   }
+
+   template <typename... Its>
+   void FillFromIterators(unsigned int slot, std::size_t n, Its... its)
+   {
+      for (std::size_t i = 0; i < n; ++i)
+         FillValues(slot, *(its++)...);
+   }
+
+public:
+   FillSharedOperation(std::shared_ptr<TH1> h, bool isWeighted, unsigned int nSlots)
+      : fResultHist(h), fHist(*h, isWeighted, nSlots)
+   {
+   }
+
+   template <typename... Ts, typename std::enable_if<TAllOf<!TIsContainer<Ts>::fgValue...>::value, int>::type = 0>
+   void Exec(const Ts &... vs, unsigned int slot)
+   {
+      FillValues(slot, vs...);
+   }
+
+   template <typename T, typename... Ts,
+             typename std::enable_if<TAllOf<TIsContainer<T>::fgValue, TIsContainer<Ts>::fgValue...>::value, int>::type = 0>
+   void Exec(const T &vs, const Ts &... otherVs, unsigned int slot)
+   {
+      const std::size_t n = vs.size();
+      const std::initializer_list<std::size_t> otherNs = {otherVs.size()...};
+      for (auto otherN : otherNs) {
+         if (otherN != n)
+            throw std::runtime_error("collections used to fill a histogram must have the same size");
+      }
+      FillFromIterators(slot, n, std::begin(vs), std::begin(otherVs)...);
+   }
+
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && !TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, const W &w, unsigned int slot)
+   {
+      FillFromIterators(slot, vs.size(), std::begin(vs), TConstWeight(w));
+   }
+
+   ~FillSharedOperation()
+   {
+      fHist.AddTo(*fResultHist);
+   }
+};
+
+// Each slot fills its own copy of the histogram (or profile), copies are merged
+// at the end of the loop. The values of several branches are passed to HIST::Fill
+// in the order of the branches. If the branches are collections they are
+// iterated over together, and HIST::Fill is called once per element.
+template <typename HIST = TH1F>
 class FillTOOperation {
-   TThreadedObject<TH1F> fTo;
+   TThreadedObject<HIST> fTo;
+
+   HIST &GetSlotHist(unsigned int slot)
+   {
+      auto h = fTo.GetAtSlotUnchecked(slot);
+      return h ? *h : *fTo.GetAtSlot(slot);
+   }
+
+   template <typename... Its>
+   void FillFromIterators(HIST &h, std::size_t n, Its... its)
+   {
+      for (std::size_t i = 0; i < n; ++i)
+         h.Fill(*(its++)...);
+   }
+
+   // one-dimensional histograms, with or without weights, use the batched fill
+   template <typename XIt>
+   void FillFromIterators(TH1F &h, std::size_t n, XIt xs)
+   {
+      FillBatched(h, n, xs);
+   }
+
+   template <typename XIt, typename WIt>
+   void FillFromIterators(TH1F &h, std::size_t n, XIt xs, WIt ws)
+   {
+      FillBatched(h, n, xs, ws);
+   }
 
 public:
 
-   FillTOOperation(std::shared_ptr<TH1F> h, unsigned int nSlots) : fTo(*h)
+   // the histograms of the other slots are copied from h when the slots first use them:
+   // slots that process no entries do not take any memory, and are not merged
+   FillTOOperation(std::shared_ptr<HIST> h) : fTo(*h)
    {
       fTo.SetAtSlot(0, h);
-      // Initialise all other slots
-      for (unsigned int i = 0 ; i < nSlots; ++i) {
-         fTo.GetAtSlot(i);
-      }
    }
 
-   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(T v, unsigned int slot)
+   template <typename... Ts, typename std::enable_if<TAllOf<!TIsContainer<Ts>::fgValue...>::value, int>::type = 0>
+   void Exec(const Ts &... vs, unsigned int slot)
    {
-      fTo.GetAtSlotUnchecked(slot)->Fill(v);
+      GetSlotHist(slot).Fill(vs...);
    }
 
-   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
-   void Exec(const T &vs, unsigned int slot)
+   template <typename T, typename... Ts,
+             typename std::enable_if<TAllOf<TIsContainer<T>::fgValue, TIsContainer<Ts>::fgValue...>::value, int>::type = 0>
+   void Exec(const T &vs, const Ts &... otherVs, unsigned int slot)
    {
-      auto thisSlotH = fTo.GetAtSlotUnchecked(slot);
-      for (auto& v : vs) {
-         thisSlotH->Fill(v); // TODO: Can be optimised in case T == vector<double>
+      const std::size_t n = vs.size();
+      const std::initializer_list<std::size_t> otherNs = {otherVs.size()...};
+      for (auto otherN : otherNs) {
+         if (otherN != n)
+            throw std::runtime_error("collections used to fill a histogram must have the same size");
       }
+      FillFromIterators(GetSlotHist(slot), n, std::begin(vs), std::begin(otherVs)...);
+   }
+
+   // the scalar, e.g. a weight, is used together with each element of the collection
+   template <typename T, typename W,
+             typename std::enable_if<TIsContainer<T>::fgValue && !TIsContainer<W>::fgValue, int>::type = 0>
+   void Exec(const T &vs, const W &w, unsigned int slot)
+   {
+      FillFromIterators(GetSlotHist(slot), vs.size(), std::begin(vs), TConstWeight(w));
    }
 
    ~FillTOOperation()
@@ -522,77 +2309,621 @@ template<typename T, typename COLL>
 class TakeOperation {
    std::vector<std::shared_ptr<COLL>> fColls;
 public:
-   TakeOperation(std::shared_ptr<COLL> resultColl, unsigned int nSlots)
+   // the collections of the other slots are created when the slots first use them
+   TakeOperation(std::shared_ptr<COLL> resultColl, unsigned int nSlots) : fColls(nSlots)
    {
-      fColls.emplace_back(resultColl);
-      for (unsigned int i = 1; i < nSlots; ++i)
-         fColls.emplace_back(std::make_shared<COLL>());
+      fColls[0] = resultColl;
    }
 
-   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(V v, unsigned int slot)
+   // collections are stored as they are, one per entry: see TakeFlatOperation
+   // for a contiguous layout of their elements
+   void Exec(const T &v, unsigned int slot)
+   {
+      auto &coll = fColls[slot];
+      if (!coll) coll = std::make_shared<COLL>();
+      coll->emplace_back(v);
+   }
+
+   ~TakeOperation()
+   {
+      auto rColl = fColls[0];
+      for (unsigned int i = 1; i < fColls.size(); ++i) {
+         auto& coll = fColls[i];
+         if (!coll) continue;
+         for (T &v : *coll) {
+            rColl->emplace_back(v);
+         }
+      }
+   }
+};
+
+// note: changes to this class should probably be replicated in its unspecialized
+// declaration above
+template<typename T>
+class TakeOperation<T, std::vector<T>> {
+   std::vector<std::shared_ptr<std::vector<T>>> fColls;
+public:
+   TakeOperation(std::shared_ptr<std::vector<T>> resultColl, unsigned int nSlots) : fColls(nSlots)
    {
-      fColls[slot]->emplace_back(v);
+      fColls[0] = resultColl;
    }
 
-   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(const V &vs, unsigned int slot)
+   void Exec(const T &v, unsigned int slot)
    {
-      auto thisColl = fColls[slot];
-      thisColl.insert(std::begin(thisColl), std::begin(vs), std::begin(vs));
+      auto &coll = fColls[slot];
+      if (!coll) {
+         coll = std::make_shared<std::vector<T>>();
+         coll->reserve(1024);
+      }
+      coll->emplace_back(v);
    }
 
    ~TakeOperation()
    {
+      unsigned int totSize = 0;
+      for (auto& coll : fColls) totSize += coll ? coll->size() : 0;
       auto rColl = fColls[0];
+      rColl->reserve(totSize);
       for (unsigned int i = 1; i < fColls.size(); ++i) {
          auto& coll = fColls[i];
-         for (T &v : *coll) {
-            rColl->emplace_back(v);
+         if (!coll) continue;
+         rColl->insert(rColl->end(), coll->begin(), coll->end());
+      }
+   }
+};
+
+// One buffer per cluster of the tree. Each cluster is processed by a single
+// slot, so every slot can fill the buffer of its current cluster without
+// synchronisation, and results can be merged back in entry order whatever the
+// order in which clusters were processed.
+template <typename Buf>
+class TClusterBuffers {
+   std::vector<Long64_t> fClusterStarts; // first entry of each cluster, followed by the number of entries
+   std::vector<Buf> fBuffers;
+   std::vector<Buf *> fCurrentBuffers;
+   std::vector<Long64_t> fCurrentBegins;
+   std::vector<Long64_t> fCurrentEnds;
+
+public:
+   TClusterBuffers(TTree *tree, unsigned int nSlots)
+      : fCurrentBuffers(nSlots, nullptr), fCurrentBegins(nSlots, 0), fCurrentEnds(nSlots, 0)
+   {
+      const auto nEntries = tree->GetEntries();
+      auto clusterIt = tree->GetClusterIterator(0);
+      Long64_t start;
+      while ((start = clusterIt()) < nEntries) fClusterStarts.emplace_back(start);
+      fClusterStarts.emplace_back(nEntries);
+      fBuffers.resize(fClusterStarts.size() - 1);
+   }
+
+   /// Make the buffer of the cluster containing `entry` the current buffer of `slot`.
+   /// Return the number of entries of the cluster if the current buffer changed, 0 otherwise.
+   Long64_t Select(unsigned int slot, int entry)
+   {
+      if (entry >= fCurrentBegins[slot] && entry < fCurrentEnds[slot]) return 0;
+      auto clusterIt = std::upper_bound(fClusterStarts.begin(), fClusterStarts.end(), (Long64_t)entry) - 1;
+      fCurrentBegins[slot] = *clusterIt;
+      fCurrentEnds[slot] = *(clusterIt + 1);
+      fCurrentBuffers[slot] = &fBuffers[clusterIt - fClusterStarts.begin()];
+      return fCurrentEnds[slot] - fCurrentBegins[slot];
+   }
+
+   Buf &GetCurrent(unsigned int slot) { return *fCurrentBuffers[slot]; }
+
+   /// All buffers, in entry order
+   std::vector<Buf> &GetBuffers() { return fBuffers; }
+};
+
+// Values are returned in entry order, whatever the order in which the clusters
+// of the tree are processed by the different slots.
+// If no filter is applied upstream, every value is written directly at its
+// final position in the output, which is preallocated with the number of
+// entries of the tree. Otherwise values are collected in one buffer per cluster
+// and the buffers are concatenated in cluster order at the end of the event loop.
+template <typename T>
+class TakeOrderedOperation {
+   std::shared_ptr<std::vector<T>> fResultColl;
+   // std::vector<bool> packs its elements: concurrent writes to different elements are not safe
+   const bool fWriteInPlace;
+   const double fEfficiency;
+   std::unique_ptr<TClusterBuffers<std::vector<T>>> fClusterColls;
+
+public:
+   TakeOrderedOperation(std::shared_ptr<std::vector<T>> resultColl, TTree *tree, bool isFiltered, double efficiency,
+                        unsigned int nSlots)
+      : fResultColl(resultColl), fWriteInPlace(!isFiltered && !std::is_same<T, bool>::value),
+        fEfficiency(std::min(std::max(efficiency, 0.), 1.))
+   {
+      if (fWriteInPlace)
+         fResultColl->resize(tree->GetEntries());
+      else
+         fClusterColls.reset(new TClusterBuffers<std::vector<T>>(tree, nSlots));
+   }
+
+   void Exec(const T &v, unsigned int slot, int entry)
+   {
+      if (fWriteInPlace) {
+         (*fResultColl)[entry] = v;
+         return;
+      }
+      if (auto clusterSize = fClusterColls->Select(slot, entry))
+         fClusterColls->GetCurrent(slot).reserve(clusterSize * fEfficiency);
+      fClusterColls->GetCurrent(slot).emplace_back(v);
+   }
+
+   ~TakeOrderedOperation()
+   {
+      if (fWriteInPlace) return;
+      auto &colls = fClusterColls->GetBuffers();
+      std::size_t totSize = 0;
+      for (auto &coll : colls) totSize += coll.size();
+      fResultColl->reserve(totSize);
+      for (auto &coll : colls) {
+         fResultColl->insert(fResultColl->end(), std::make_move_iterator(coll.begin()),
+                             std::make_move_iterator(coll.end()));
+         std::vector<T>().swap(coll);
+      }
+   }
+};
+
+// The elements of the collections of all entries are stored contiguously, in
+// entry order. Buffers are kept per cluster as for TakeOrderedOperation, and
+// their offsets are rebased when they are concatenated at the end of the loop.
+template <typename T, typename BranchType>
+class TakeFlatOperation {
+   std::shared_ptr<TFlatCollection<T>> fResultColl;
+   const double fEfficiency;
+   TClusterBuffers<TFlatCollection<T>> fClusterColls;
+
+public:
+   TakeFlatOperation(std::shared_ptr<TFlatCollection<T>> resultColl, TTree *tree, double efficiency,
+                     unsigned int nSlots)
+      : fResultColl(resultColl), fEfficiency(std::min(std::max(efficiency, 0.), 1.)), fClusterColls(tree, nSlots)
+   {
+   }
+
+   void Exec(const BranchType &vs, unsigned int slot, int entry)
+   {
+      if (auto clusterSize = fClusterColls.Select(slot, entry))
+         fClusterColls.GetCurrent(slot).GetOffsets().reserve(clusterSize * fEfficiency + 1);
+      auto &coll = fClusterColls.GetCurrent(slot);
+      auto &values = coll.GetValues();
+      values.insert(values.end(), std::begin(vs), std::end(vs));
+      coll.GetOffsets().emplace_back(values.size());
+   }
+
+   // The buffer of the first cluster becomes the result. Those of the other
+   // clusters are moved to its end one at a time, each released right after, so
+   // that no value is held twice beyond the buffer being appended.
+   ~TakeFlatOperation()
+   {
+      auto &colls = fClusterColls.GetBuffers();
+      if (colls.empty()) return;
+      auto &result = *fResultColl;
+      result = std::move(colls.front());
+      auto &values = result.GetValues();
+      auto &offsets = result.GetOffsets();
+      for (auto coll = colls.begin() + 1; coll != colls.end(); ++coll) {
+         const auto base = values.size();
+         auto &collValues = coll->GetValues();
+         values.insert(values.end(), std::make_move_iterator(collValues.begin()),
+                       std::make_move_iterator(collValues.end()));
+         for (auto it = coll->GetOffsets().begin() + 1; it != coll->GetOffsets().end(); ++it)
+            offsets.emplace_back(base + *it);
+         *coll = TFlatCollection<T>();
+      }
+   }
+};
+
+// Keeps the k largest values seen by each slot in a heap whose top is the smallest
+// of them, so that every value costs at most a comparison and an O(log k) update
+template <typename T, typename Compare>
+class TopKOperation {
+   std::shared_ptr<std::vector<T>> fResultValues;
+   std::size_t fK;
+   Compare fCompare;
+   std::vector<std::vector<T>> fHeaps;
+
+public:
+   TopKOperation(std::shared_ptr<std::vector<T>> resultValues, std::size_t k, Compare compare, unsigned int nSlots)
+      : fResultValues(resultValues), fK(k), fCompare(compare), fHeaps(nSlots) {}
+
+   void Exec(const T &v, unsigned int slot)
+   {
+      auto &heap = fHeaps[slot];
+      // with reversed arguments, the heap keeps its smallest value on top
+      auto greater = [this](const T &a, const T &b) { return fCompare(b, a); };
+      if (heap.size() < fK) {
+         if (heap.capacity() == 0) heap.reserve(fK);
+         heap.emplace_back(v);
+         std::push_heap(heap.begin(), heap.end(), greater);
+      } else if (fK > 0 && fCompare(heap.front(), v)) {
+         std::pop_heap(heap.begin(), heap.end(), greater);
+         heap.back() = v;
+         std::push_heap(heap.begin(), heap.end(), greater);
+      }
+   }
+
+   ~TopKOperation()
+   {
+      auto &values = *fResultValues;
+      for (auto &heap : fHeaps) values.insert(values.end(), heap.begin(), heap.end());
+      auto greater = [this](const T &a, const T &b) { return fCompare(b, a); };
+      const auto k = std::min(fK, values.size());
+      std::partial_sort(values.begin(), values.begin() + k, values.end(), greater);
+      values.resize(k);
+   }
+};
+
+// Every slot collects its values. At the end of the event loop the runs of the
+// slots are sorted as parallel tasks, then split at sampled splitter values in
+// pieces that are merged, as parallel tasks too, straight to their place in the
+// result. If the values of a slot take more than its share of the memory
+// budget, they are sorted and written to a temporary file, and the runs are
+// merged from there.
+template <typename T, typename Compare>
+class TakeSortedOperation {
+   std::shared_ptr<std::vector<T>> fResultValues;
+   Compare fCompare;
+   std::vector<std::vector<T>> fRuns;
+   std::size_t fMaxRunSize; // per slot, before spilling
+   std::vector<TSpillFile<T>> fSpillFiles;
+
+   void Spill(unsigned int slot)
+   {
+      auto &run = fRuns[slot];
+      std::sort(run.begin(), run.end(), fCompare);
+      fSpillFiles[slot].WriteRun(run.begin(), run.end());
+      run.clear();
+   }
+
+public:
+   TakeSortedOperation(std::shared_ptr<std::vector<T>> resultValues, Compare compare, ULong64_t memoryBudget,
+                       unsigned int nSlots)
+      : fResultValues(resultValues), fCompare(compare), fRuns(nSlots),
+        fMaxRunSize(std::numeric_limits<std::size_t>::max()), fSpillFiles(nSlots)
+   {
+      if (memoryBudget > 0 && std::is_trivially_copyable<T>::value)
+         fMaxRunSize = std::max<std::size_t>(1, memoryBudget / nSlots / sizeof(T));
+   }
+
+   void Exec(const T &v, unsigned int slot)
+   {
+      auto &run = fRuns[slot];
+      if (run.capacity() == 0) run.reserve(std::min<std::size_t>(1024, fMaxRunSize));
+      run.emplace_back(v);
+      if (run.size() >= fMaxRunSize) Spill(slot);
+   }
+
+   ~TakeSortedOperation()
+   {
+      auto &values = *fResultValues;
+      // the elements of a std::vector<bool> share bytes: they cannot be written in parallel
+      const unsigned int nPieces = std::is_same<T, bool>::value ? 1 : fRuns.size();
+      auto isSpilled = [](const TSpillFile<T> &f) { return f.GetNRuns() > 0; };
+      if (std::any_of(fSpillFiles.begin(), fSpillFiles.end(), isSpilled)) {
+         ParallelFor(fRuns.size(), [this](unsigned int slot) {
+            Spill(slot);
+            std::vector<T>().swap(fRuns[slot]);
+         });
+         std::size_t totSize = 0;
+         for (auto &file : fSpillFiles) totSize += file.GetSize();
+         values.resize(totSize);
+         MergeSpilledRuns(fSpillFiles, fCompare, nPieces,
+                          [&values](unsigned int, std::size_t pos, const T &v) { values[pos] = v; });
+         return;
+      }
+
+      ParallelFor(fRuns.size(),
+                  [this](unsigned int slot) { std::sort(fRuns[slot].begin(), fRuns[slot].end(), fCompare); });
+      std::vector<std::size_t> runSizes;
+      for (auto &run : fRuns) runSizes.emplace_back(run.size());
+      std::vector<std::vector<std::size_t>> bounds;
+      std::vector<std::size_t> offsets;
+      SplitSortedRuns<T>(runSizes, fCompare, nPieces, [this](std::size_t r, std::size_t i) -> T { return fRuns[r][i]; },
+                         bounds, offsets);
+      values.resize(offsets.back());
+      ParallelFor(nPieces, [&](unsigned int piece) {
+         using It_t = typename std::vector<T>::iterator;
+         std::vector<std::pair<It_t, It_t>> heads;
+         for (std::size_t r = 0; r < fRuns.size(); ++r)
+            heads.emplace_back(fRuns[r].begin() + bounds[piece][r], fRuns[r].begin() + bounds[piece + 1][r]);
+         MergeSortedRanges(heads, fCompare, values.begin() + offsets[piece]);
+      });
+   }
+};
+
+// A hash table with open addressing and linear probing: keys and values are
+// stored in flat arrays, so that looking up a key that is already present, by
+// far the most common case when aggregating per key, costs a hash and usually
+// a single comparison. The capacity is a power of two, kept at least twice the size.
+template <typename K, typename V>
+class TKeyedTable {
+   std::vector<K> fKeys;
+   std::vector<V> fValues;
+   std::vector<char> fUsed;
+   std::size_t fSize = 0;
+
+   // the position of the key, or of the free element where it should be inserted
+   std::size_t Find(const K &key) const
+   {
+      const std::size_t mask = fKeys.size() - 1;
+      auto i = std::size_t(MixHash(std::hash<K>()(key))) & mask;
+      while (fUsed[i] && !(fKeys[i] == key)) i = (i + 1) & mask;
+      return i;
+   }
+
+   void Grow()
+   {
+      TKeyedTable<K, V> grown;
+      grown.Reserve(2 * fKeys.size());
+      for (std::size_t i = 0; i < fKeys.size(); ++i) {
+         if (!fUsed[i]) continue;
+         const auto j = grown.Find(fKeys[i]);
+         grown.fKeys[j] = std::move(fKeys[i]);
+         grown.fValues[j] = std::move(fValues[i]);
+         grown.fUsed[j] = 1;
+      }
+      grown.fSize = fSize;
+      std::swap(*this, grown);
+   }
+
+public:
+   void Reserve(std::size_t capacity)
+   {
+      fKeys.resize(capacity);
+      fValues.resize(capacity);
+      fUsed.resize(capacity, 0);
+   }
+
+   // The value of the key, default-constructed if the key is new
+   V &Get(const K &key, bool &isNew)
+   {
+      if (fKeys.empty()) Reserve(64);
+      auto i = Find(key);
+      isNew = !fUsed[i];
+      if (isNew) {
+         if (2 * (fSize + 1) > fKeys.size()) {
+            Grow();
+            i = Find(key);
+         }
+         fKeys[i] = key;
+         fUsed[i] = 1;
+         ++fSize;
+      }
+      return fValues[i];
+   }
+
+   std::size_t GetSize() const { return fSize; }
+   std::size_t GetCapacity() const { return fKeys.size(); }
+
+   void Clear() { *this = TKeyedTable<K, V>(); }
+
+   template <typename F>
+   void ForEach(F f)
+   {
+      for (std::size_t i = 0; i < fKeys.size(); ++i)
+         if (fUsed[i]) f(fKeys[i], fValues[i]);
+   }
+};
+
+// Calls f(part, key, value) on the keys and values of the tables of all slots,
+// which are split in nParts partitions by the hash of the key. Each partition is
+// handled by a separate task, and sees the values of a key in slot order: f can
+// merge them in a state of its partition without locking.
+template <typename K, typename V, typename F>
+void ForEachByPartition(std::vector<TKeyedTable<K, V>> &tables, unsigned int nParts, F f)
+{
+   // the keys and values of each slot, by partition
+   using KeyValue_t = std::pair<const K *, V *>;
+   std::vector<std::vector<std::vector<KeyValue_t>>> slotParts(tables.size());
+   ParallelFor(tables.size(), [&](unsigned int slot) {
+      auto &parts = slotParts[slot];
+      parts.resize(nParts);
+      tables[slot].ForEach([&parts, nParts](const K &key, V &v) {
+         parts[MixHash(std::hash<K>()(key)) % nParts].emplace_back(&key, &v);
+      });
+   });
+   ParallelFor(nParts, [&](unsigned int part) {
+      for (auto &parts : slotParts)
+         for (auto &kv : parts[part]) f(part, *kv.first, *kv.second);
+   });
+}
+
+// Accumulates a value per key in every slot: `r = acc(r, v)`, starting from
+// `init` for each new key. Per-slot results of the same key are combined with `merge`,
+// in parallel tasks that each handle a partition of the keys.
+// If the table of a slot takes more than its share of the memory budget, its
+// keys and values are written to a temporary file, sorted by key, and the table
+// is emptied; the sorted runs are merged at the end.
+template <typename K, typename T, typename R, typename Acc, typename Merge>
+class AggregateByKeyOperation {
+   struct TKeyValue {
+      K fKey;
+      R fValue;
+   };
+   std::shared_ptr<std::map<K, R>> fResult;
+   Acc fAcc;
+   Merge fMerge;
+   R fInit;
+   std::vector<TKeyedTable<K, R>> fTables;
+   std::size_t fMaxCapacity; // per slot, before spilling
+   std::vector<TSpillFile<TKeyValue>> fSpillFiles;
+
+   void Spill(unsigned int slot)
+   {
+      auto &table = fTables[slot];
+      std::vector<TKeyValue> keyValues;
+      keyValues.reserve(table.GetSize());
+      table.ForEach([&keyValues](const K &key, R &r) { keyValues.push_back({key, r}); });
+      std::sort(keyValues.begin(), keyValues.end(),
+                [](const TKeyValue &a, const TKeyValue &b) { return a.fKey < b.fKey; });
+      fSpillFiles[slot].WriteRun(keyValues.begin(), keyValues.end());
+      table.Clear();
+   }
+
+   void MergeSpilled()
+   {
+      ParallelFor(fTables.size(), [this](unsigned int slot) { Spill(slot); });
+      // all key-values of a key fall in the same piece of the merge, which
+      // aggregates them in its own list; the lists come in key order
+      const unsigned int nPieces = fSpillFiles.size();
+      std::vector<std::vector<TKeyValue>> pieces(nPieces);
+      auto byKey = [](const TKeyValue &a, const TKeyValue &b) { return a.fKey < b.fKey; };
+      // key-values come sorted by key: those of the same key are consecutive
+      MergeSpilledRuns(fSpillFiles, byKey, nPieces, [&](unsigned int piece, std::size_t, const TKeyValue &kv) {
+         auto &keyValues = pieces[piece];
+         if (!keyValues.empty() && !(keyValues.back().fKey < kv.fKey))
+            keyValues.back().fValue = fMerge(keyValues.back().fValue, kv.fValue);
+         else
+            keyValues.push_back(kv);
+      });
+      auto &result = *fResult;
+      for (auto &keyValues : pieces)
+         for (auto &kv : keyValues) result.emplace_hint(result.end(), kv.fKey, kv.fValue);
+   }
+
+public:
+   AggregateByKeyOperation(std::shared_ptr<std::map<K, R>> result, Acc acc, Merge merge, const R &init,
+                           ULong64_t memoryBudget, unsigned int nSlots)
+      : fResult(result), fAcc(acc), fMerge(merge), fInit(init), fTables(nSlots),
+        fMaxCapacity(std::numeric_limits<std::size_t>::max()), fSpillFiles(nSlots)
+   {
+      // keys, values and a flag per element of the table
+      const std::size_t elementSize = sizeof(K) + sizeof(R) + 1;
+      if (memoryBudget > 0 && std::is_trivially_copyable<TKeyValue>::value)
+         fMaxCapacity = std::max<std::size_t>(1, memoryBudget / nSlots / elementSize);
+   }
+
+   void Exec(const K &key, const T &v, unsigned int slot)
+   {
+      bool isNew;
+      auto &r = fTables[slot].Get(key, isNew);
+      if (isNew) r = fInit;
+      r = fAcc(r, v);
+      if (isNew && fTables[slot].GetCapacity() > fMaxCapacity) Spill(slot);
+   }
+
+   ~AggregateByKeyOperation()
+   {
+      auto isSpilled = [](const TSpillFile<TKeyValue> &f) { return f.GetNRuns() > 0; };
+      if (std::any_of(fSpillFiles.begin(), fSpillFiles.end(), isSpilled)) {
+         MergeSpilled();
+         return;
+      }
+      const unsigned int nParts = fTables.size();
+      std::vector<std::map<K, R>> parts(nParts);
+      ForEachByPartition(fTables, nParts, [&](unsigned int part, const K &key, R &r) {
+         auto &partResult = parts[part];
+         auto it = partResult.find(key);
+         if (it == partResult.end())
+            partResult.emplace(key, std::move(r));
+         else
+            it->second = fMerge(it->second, r);
+      });
+      // partitions hold disjoint keys
+      auto &result = *fResult;
+      for (auto &partResult : parts)
+         for (auto &kv : partResult) result.emplace(kv.first, std::move(kv.second));
+   }
+};
+
+// Fills a histogram per key in every slot, adding up those of the same key at the
+// end, in parallel tasks that each handle a partition of the keys
+template <typename K>
+class HistoByKeyOperation {
+   std::shared_ptr<std::map<K, TH1F>> fResult;
+   std::shared_ptr<TH1F> fModel;
+   std::vector<TKeyedTable<K, std::unique_ptr<TH1F>>> fTables;
+
+   TH1F &GetHist(const K &key, unsigned int slot)
+   {
+      bool isNew;
+      auto &h = fTables[slot].Get(key, isNew);
+      if (isNew) h.reset(NewDetachedCopy(*fModel));
+      return *h;
+   }
+
+public:
+   HistoByKeyOperation(std::shared_ptr<std::map<K, TH1F>> result, const TH1F &model, unsigned int nSlots)
+      : fResult(result), fModel(NewDetachedCopy(model)), fTables(nSlots)
+   {
+      fModel->Reset();
+   }
+
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const K &key, const T &v, unsigned int slot)
+   {
+      GetHist(key, slot).Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const K &key, const T &vs, unsigned int slot)
+   {
+      auto &h = GetHist(key, slot);
+      for (auto &&v : vs) h.Fill(v);
+   }
+
+   ~HistoByKeyOperation()
+   {
+      // the histogram of the first slot that filled a key takes those of the other slots
+      const unsigned int nParts = fTables.size();
+      std::vector<std::map<K, std::unique_ptr<TH1F>>> parts(nParts);
+      ForEachByPartition(fTables, nParts, [&](unsigned int part, const K &key, std::unique_ptr<TH1F> &h) {
+         auto &partResult = parts[part];
+         auto it = partResult.find(key);
+         if (it == partResult.end()) {
+            partResult.emplace(key, std::move(h));
+         } else {
+            TList slotHist;
+            slotHist.Add(h.get());
+            it->second->Merge(&slotHist);
+         }
+      });
+      // partitions hold disjoint keys; the copies are not registered to any directory,
+      // which would take a linear search per key to undo
+      const TDirectory::TContext ctx(nullptr);
+      auto &result = *fResult;
+      for (auto &partResult : parts) {
+         for (auto &kv : partResult) {
+            auto it = result.emplace(kv.first, *kv.second).first;
+            it->second.SetDirectory(nullptr);
          }
       }
    }
 };
 
-// note: changes to this class should probably be replicated in its unspecialized
-// declaration above
-template<typename T>
-class TakeOperation<T, std::vector<T>> {
-   std::vector<std::shared_ptr<std::vector<T>>> fColls;
+// Does nothing per entry: the statistics are collected by the named filters
+// themselves, and copied to the report at the end of the event loop
+class ReportOperation {
+   TCutFlowReport *fReport;
+   std::weak_ptr<Details::TDataFrameImpl> fDataFrame;
+
 public:
-   TakeOperation(std::shared_ptr<std::vector<T>> resultColl, unsigned int nSlots)
-   {
-      fColls.emplace_back(resultColl);
-      for (unsigned int i = 1; i < nSlots; ++i) {
-         auto v = std::make_shared<std::vector<T>>();
-         v->reserve(1024);
-         fColls.emplace_back(v);
-      }
-   }
+   ReportOperation(TCutFlowReport *report, std::weak_ptr<Details::TDataFrameImpl> df)
+      : fReport(report), fDataFrame(df) {}
+   ~ReportOperation();
+};
 
-   template <typename V, typename std::enable_if<!TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(V v, unsigned int slot)
-   {
-      fColls[slot]->emplace_back(v);
-   }
+// One TCovariance per slot, merged at the end
+class CovarianceOperation {
+   TCovariance *fResultCovariance;
+   std::vector<TCovariance> fCovariances;
+
+public:
+   CovarianceOperation(TCovariance *covariancePtr, unsigned int nSlots)
+      : fResultCovariance(covariancePtr), fCovariances(nSlots, *covariancePtr) {}
 
-   template <typename V, typename std::enable_if<TIsContainer<V>::fgValue, int>::type = 0>
-   void Exec(const V &vs, unsigned int slot)
+   template <typename T>
+   void Exec(const T *values, unsigned int slot)
    {
-      auto thisColl = fColls[slot];
-      thisColl->insert(std::begin(thisColl), std::begin(vs), std::begin(vs));
+      fCovariances[slot].Fill(values);
    }
 
-   ~TakeOperation()
+   ~CovarianceOperation()
    {
-      unsigned int totSize = 0;
-      for (auto& coll : fColls) totSize += coll->size();
-      auto rColl = fColls[0];
-      rColl->reserve(totSize);
-      for (unsigned int i = 1; i < fColls.size(); ++i) {
-         auto& coll = fColls[i];
-         rColl->insert(rColl->end(), coll->begin(), coll->end());
-      }
+      *fResultCovariance = TCovariance(fResultCovariance->GetNames());
+      for (auto &c : fCovariances) fResultCovariance->Merge(c);
    }
 };
 
@@ -651,14 +2982,14 @@ public:
 class MeanOperation {
    double *fResultMean;
    std::vector<Count_t> fCounts;
-   std::vector<double> fSums;
+   std::vector<TCompensatedSum> fSums;
 
 public:
-   MeanOperation(double *meanVPtr, unsigned int nSlots) : fResultMean(meanVPtr), fCounts(nSlots, 0), fSums(nSlots, 0) {}
+   MeanOperation(double *meanVPtr, unsigned int nSlots) : fResultMean(meanVPtr), fCounts(nSlots, 0), fSums(nSlots) {}
    template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
    void Exec(T v, unsigned int slot)
    {
-      fSums[slot] += v;
+      fSums[slot].Add(v);
       fCounts[slot] ++;
    }
 
@@ -666,24 +2997,259 @@ public:
    void Exec(const T &vs, unsigned int slot)
    {
       for (auto &&v : vs) {
-         fSums[slot] += v;
+         fSums[slot].Add(v);
          fCounts[slot]++;
       }
    }
 
    ~MeanOperation()
    {
-      double sumOfSums = 0;
-      for (auto &s : fSums) sumOfSums += s;
+      TCompensatedSum sumOfSums;
+      for (auto &s : fSums) sumOfSums.Add(s);
       Count_t sumOfCounts = 0;
       for (auto &c : fCounts) sumOfCounts += c;
-      *fResultMean = sumOfSums / (sumOfCounts > 0 ? sumOfCounts : 1);
+      *fResultMean = sumOfSums.GetSum() / (sumOfCounts > 0 ? sumOfCounts : 1);
+   }
+};
+
+class SumOperation {
+   double *fResultSum;
+   std::vector<TCompensatedSum> fSums;
+
+public:
+   SumOperation(double *sumVPtr, unsigned int nSlots) : fResultSum(sumVPtr), fSums(nSlots) {}
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fSums[slot].Add(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) fSums[slot].Add(v);
+   }
+
+   ~SumOperation()
+   {
+      TCompensatedSum sumOfSums;
+      for (auto &s : fSums) sumOfSums.Add(s);
+      *fResultSum = sumOfSums.GetSum();
+   }
+};
+
+class StatsOperation {
+   TStatistics *fResultStats;
+   std::vector<TStatistics> fStats;
+
+protected:
+   TStatistics MergeSlots() const
+   {
+      TStatistics stats;
+      for (auto &s : fStats) stats.Merge(s);
+      return stats;
+   }
+
+public:
+   StatsOperation(TStatistics *statsPtr, unsigned int nSlots) : fResultStats(statsPtr), fStats(nSlots) {}
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      fStats[slot].Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      for (auto &&v : vs) fStats[slot].Fill(v);
+   }
+
+   ~StatsOperation()
+   {
+      if (fResultStats) *fResultStats = MergeSlots();
+   }
+};
+
+// Same as StatsOperation, but only the variance (or the standard deviation) is returned
+class VarianceOperation : public StatsOperation {
+   double *fResultVariance;
+   bool fIsStdDev;
+
+public:
+   VarianceOperation(double *varianceVPtr, bool isStdDev, unsigned int nSlots)
+      : StatsOperation(nullptr, nSlots), fResultVariance(varianceVPtr), fIsStdDev(isStdDev) {}
+
+   ~VarianceOperation()
+   {
+      const auto stats = MergeSlots();
+      *fResultVariance = fIsStdDev ? stats.GetStdDev() : stats.GetVariance();
+   }
+};
+
+// A t-digest ("merging" variant, T. Dunning and O. Ertl, "Computing extremely
+// accurate quantiles using t-digests", 2019): values are clustered in centroids
+// whose weight is smaller the closer they are to the tails of the distribution,
+// so that extreme quantiles are estimated much better than the median.
+// Centroid sizes follow the k1 scale function, k(q) = compression / (2 pi) * asin(2q - 1):
+// each centroid spans at most one unit of k, hence a fraction of the values of at
+// most about 2 pi sqrt(q (1 - q)) / compression around quantile q. The estimate
+// interpolates between centroids, its rank error is bounded by half that
+// fraction: 0.8% at the median and 0.05% at the 99.9th percentile for the
+// default compression of 200. The minimum and the maximum are exact.
+// At most about compression centroids and 5 * compression unmerged values are kept.
+class TTDigest {
+   struct TCentroid {
+      double fMean;
+      double fWeight;
+      bool operator<(const TCentroid &other) const { return fMean < other.fMean; }
+   };
+   double fCompression;
+   std::vector<TCentroid> fCentroids; // sorted by mean
+   std::vector<TCentroid> fBuffer;    // not merged yet
+   ULong64_t fN = 0;
+   double fMin = std::numeric_limits<double>::max();
+   double fMax = std::numeric_limits<double>::lowest();
+
+   // the cumulative fraction of values where the centroid starting at q must end
+   double GetLimit(double q) const
+   {
+      const double pi = 3.14159265358979323846;
+      const double k = fCompression / (2 * pi) * std::asin(2 * q - 1) + 1;
+      if (k >= fCompression / 4) return 1.;
+      return (std::sin(k * 2 * pi / fCompression) + 1) / 2;
+   }
+
+   void Compress()
+   {
+      if (fBuffer.empty()) return;
+      fBuffer.insert(fBuffer.end(), fCentroids.begin(), fCentroids.end());
+      std::sort(fBuffer.begin(), fBuffer.end());
+      fCentroids.clear();
+      const double totWeight = fN;
+      double weightSoFar = 0.;
+      double limit = totWeight * GetLimit(0.);
+      auto cur = fBuffer.front();
+      for (auto it = fBuffer.begin() + 1; it != fBuffer.end(); ++it) {
+         if (weightSoFar + cur.fWeight + it->fWeight <= limit) {
+            cur.fWeight += it->fWeight;
+            cur.fMean += (it->fMean - cur.fMean) * it->fWeight / cur.fWeight;
+         } else {
+            weightSoFar += cur.fWeight;
+            fCentroids.emplace_back(cur);
+            limit = totWeight * GetLimit(weightSoFar / totWeight);
+            cur = *it;
+         }
+      }
+      fCentroids.emplace_back(cur);
+      fBuffer.clear();
+   }
+
+public:
+   explicit TTDigest(double compression = 200) : fCompression(compression) {}
+
+   void Fill(double x)
+   {
+      if (fBuffer.capacity() == 0) fBuffer.reserve(std::size_t(5 * fCompression));
+      fBuffer.push_back({x, 1.});
+      ++fN;
+      fMin = std::min(x, fMin);
+      fMax = std::max(x, fMax);
+      if (fBuffer.size() >= 5 * fCompression) Compress();
+   }
+
+   void Merge(TTDigest &other)
+   {
+      other.Compress();
+      fBuffer.insert(fBuffer.end(), other.fCentroids.begin(), other.fCentroids.end());
+      fN += other.fN;
+      fMin = std::min(other.fMin, fMin);
+      fMax = std::max(other.fMax, fMax);
+      Compress();
+   }
+
+   ULong64_t GetN() const { return fN; }
+
+   double GetQuantile(double q)
+   {
+      Compress();
+      if (fN == 0) return 0.;
+      if (q <= 0.) return fMin;
+      if (q >= 1.) return fMax;
+      // the mean of a centroid is taken to sit in the middle of its weight
+      const double index = q * fN;
+      if (index < fCentroids.front().fWeight / 2)
+         return fMin + (fCentroids.front().fMean - fMin) * index / (fCentroids.front().fWeight / 2);
+      double weightSoFar = fCentroids.front().fWeight / 2;
+      for (std::size_t i = 0; i + 1 < fCentroids.size(); ++i) {
+         const double dw = (fCentroids[i].fWeight + fCentroids[i + 1].fWeight) / 2;
+         if (weightSoFar + dw > index) {
+            const double f = (index - weightSoFar) / dw;
+            return fCentroids[i].fMean + f * (fCentroids[i + 1].fMean - fCentroids[i].fMean);
+         }
+         weightSoFar += dw;
+      }
+      const auto &last = fCentroids.back();
+      const double f = (index - weightSoFar) / (last.fWeight / 2);
+      return last.fMean + std::min(f, 1.) * (fMax - last.fMean);
+   }
+};
+
+class QuantilesOperation {
+   std::vector<double> *fResultQuantiles;
+   std::vector<double> fQuantiles;
+   double fCompression;
+   std::vector<std::unique_ptr<TTDigest>> fDigests; // created on first use
+
+   TTDigest &GetSlotDigest(unsigned int slot)
+   {
+      if (!fDigests[slot]) fDigests[slot].reset(new TTDigest(fCompression));
+      return *fDigests[slot];
+   }
+
+public:
+   QuantilesOperation(std::vector<double> *quantilesVPtr, const std::vector<double> &quantiles, double compression,
+                      unsigned int nSlots)
+      : fResultQuantiles(quantilesVPtr), fQuantiles(quantiles), fCompression(compression), fDigests(nSlots) {}
+   template <typename T, typename std::enable_if<!TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(T v, unsigned int slot)
+   {
+      GetSlotDigest(slot).Fill(v);
+   }
+
+   template <typename T, typename std::enable_if<TIsContainer<T>::fgValue, int>::type = 0>
+   void Exec(const T &vs, unsigned int slot)
+   {
+      auto &digest = GetSlotDigest(slot);
+      for (auto &&v : vs) digest.Fill(v);
+   }
+
+   ~QuantilesOperation()
+   {
+      TTDigest digest(fCompression);
+      for (auto &d : fDigests)
+         if (d) digest.Merge(*d);
+      fResultQuantiles->clear();
+      for (auto q : fQuantiles) fResultQuantiles->emplace_back(digest.GetQuantile(q));
    }
 };
 
 } // end of NS Operations
 
-enum class EActionType : short { kHisto1D, kMin, kMax, kMean };
+enum class EActionType : short {
+   kHisto1D,
+   kHisto2D,
+   kHisto3D,
+   kProfile1D,
+   kProfile2D,
+   kMin,
+   kMax,
+   kMean,
+   kSum,
+   kVariance,
+   kStdDev,
+   kStats,
+   kFill
+};
 
 } // end NS Internal
 
@@ -691,11 +3257,34 @@ namespace Details {
 // forward declarations for TDataFrameInterface
 template <typename F, typename PrevData>
 class TDataFrameFilter;
+template <typename F>
+class TDataFrameBranchExpression;
 template <typename F, typename PrevData>
 class TDataFrameBranch;
 class TDataFrameImpl;
 }
 
+namespace Internal {
+// Whether entries can be discarded by a filter before reaching a node of type T
+template <typename T>
+struct TIsFiltered {
+   static constexpr bool fgValue = true;
+};
+
+template <>
+struct TIsFiltered<Details::TDataFrameImpl> {
+   static constexpr bool fgValue = false;
+};
+
+template <typename F, typename PrevData>
+struct TIsFiltered<Details::TDataFrameBranch<F, PrevData>> {
+   static constexpr bool fgValue = TIsFiltered<PrevData>::fgValue;
+};
+} // end NS Internal
+
+template <typename K, typename Proxied>
+class TDataFrameGroupBy;
+
 /**
 * \class ROOT::TDataFrameInterface
 * \brief The public interface to the TDataFrame federation of classes: TDataFrameImpl, TDataFrameFilter, TDataFrameBranch
@@ -704,6 +3293,7 @@ class TDataFrameImpl;
 template <typename Proxied>
 class TDataFrameInterface {
    template<typename T> friend class TDataFrameInterface;
+   template <typename K, typename P> friend class TDataFrameGroupBy;
 public:
    ////////////////////////////////////////////////////////////////////////////
    /// \brief Build the dataframe
@@ -728,6 +3318,7 @@ public:
    /// \brief Append a filter to the call graph.
    /// \param[in] f Function, lambda expression, functor class or any other callable object. It must return a `bool` signalling whether the event has passed the selection (true) or not (false).
    /// \param[in] bl Names of the branches in input to the filter function.
+   /// \param[in] name Optional name of the filter. Statistics are collected for named filters, see Report.
    ///
    /// Append a filter node at the point of the call graph corresponding to the
    /// object this method is called on.
@@ -740,9 +3331,12 @@ public:
    /// one returning false causes the event to be discarded.
    /// Even if multiple actions or transformations depend on the same filter,
    /// it is executed once per entry. If its result is requested more than
-   /// once, the cached result is served.
+   /// once, the cached result is served. Booking the same filter twice on the
+   /// same node, i.e. with an equal callable, the same branches and the same
+   /// name, returns the node booked first.
    template <typename F>
-   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>> Filter(F f, const BranchVec &bl = {})
+   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>>
+   Filter(F f, const BranchVec &bl = {}, const std::string &name = "")
    {
       ROOT::Internal::CheckFilter(f);
       auto df = GetDataFrameChecked();
@@ -750,12 +3344,40 @@ public:
       auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
       const BranchVec &actualBl = Internal::PickBranchVec(nArgs, bl, defBl);
       using DFF_t = Details::TDataFrameFilter<F, Proxied>;
-      auto FilterPtr = std::make_shared<DFF_t> (f, actualBl, fProxiedPtr);
+      // an identical filter on the same node is shared rather than evaluated twice
+      for (auto &bookedFilter : df->GetBookedFilters()) {
+         auto sameFilter = std::dynamic_pointer_cast<DFF_t>(bookedFilter);
+         if (sameFilter && sameFilter->IsSameNode(f, actualBl, fProxiedPtr.get(), name))
+            return TDataFrameInterface<DFF_t>(sameFilter);
+      }
+      auto FilterPtr = std::make_shared<DFF_t> (f, actualBl, fProxiedPtr, name);
       TDataFrameInterface<DFF_t> tdf_f(FilterPtr);
       df->Book(FilterPtr);
       return tdf_f;
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Append a named filter, reading the default branches, to the call graph.
+   /// \param[in] f Function, lambda expression, functor class or any other callable object. It must return a `bool` signalling whether the event has passed the selection (true) or not (false).
+   /// \param[in] name Name of the filter. Statistics are collected for named filters, see Report.
+   template <typename F>
+   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>> Filter(F f, const std::string &name)
+   {
+      return Filter(f, {}, name);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Append a filter to the call graph.
+   /// \param[in] f Function, lambda expression, functor class or any other callable object. It must return a `bool` signalling whether the event has passed the selection (true) or not (false).
+   /// \param[in] bl Names of the branches in input to the filter function.
+   ///
+   /// Avoids the ambiguity between the other two overloads for calls like `Filter(f, {"x"})`.
+   template <typename F>
+   TDataFrameInterface<Details::TDataFrameFilter<F, Proxied>> Filter(F f, const std::initializer_list<std::string> &bl)
+   {
+      return Filter(f, BranchVec(bl), "");
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    /// \brief Creates a temporary branch
    /// \param[in] name The name of the temporary branch.
@@ -774,8 +3396,13 @@ public:
    /// * extraction of quantities of interest from complex objects
    /// * branch aliasing, i.e. changing the name of a branch
    ///
+   /// Branches computing the same expression, i.e. with an equal callable, on
+   /// the same branches share their values, which are computed once per entry.
+   /// Callables that can change their own state, like mutable lambdas, are never shared.
+   ///
    /// An exception is thrown if the name of the new branch is already in use
-   /// for another branch in the TTree.
+   /// for another branch in the TTree, or if it is "tdfentry_", which is
+   /// reserved for the number of the current entry.
    template <typename F>
    TDataFrameInterface<Details::TDataFrameBranch<F, Proxied>>
    AddBranch(const std::string &name, F expression, const BranchVec &bl = {})
@@ -786,7 +3413,19 @@ public:
       auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
       const BranchVec &actualBl = Internal::PickBranchVec(nArgs, bl, defBl);
       using DFB_t = Details::TDataFrameBranch<F, Proxied>;
+      // an identical branch on the same node is shared; a branch with another
+      // name but the same expression and inputs shares its cached values
+      std::shared_ptr<Details::TDataFrameBranchExpression<F>> sameBranch;
+      for (auto &bookedBranch : df->GetBookedBranches()) {
+         auto branch = std::dynamic_pointer_cast<Details::TDataFrameBranchExpression<F>>(bookedBranch.second);
+         if (!branch || !branch->IsSameExpression(expression, actualBl)) continue;
+         auto sameNode = std::dynamic_pointer_cast<DFB_t>(branch);
+         if (sameNode && sameNode->IsSameNode(name, expression, actualBl, fProxiedPtr.get()))
+            return TDataFrameInterface<DFB_t>(sameNode);
+         sameBranch = branch;
+      }
       auto BranchPtr = std::make_shared<DFB_t>(name, expression, actualBl, fProxiedPtr);
+      if (sameBranch) BranchPtr->ShareValuesWith(*sameBranch);
       TDataFrameInterface<DFB_t> tdf_b(BranchPtr);
       df->Book(BranchPtr);
       return tdf_b;
@@ -813,77 +3452,286 @@ public:
    }
 
    ////////////////////////////////////////////////////////////////////////////
-   /// \brief Execute a user-defined function requiring a processing slot index on each entry (*instant action*)
-   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
-   /// \param[in] bl Names of the branches in input to the user function.
+   /// \brief Execute a user-defined function requiring a processing slot index on each entry (*instant action*)
+   /// \param[in] f Function, lambda expression, functor class or any other callable object performing user defined calculations.
+   /// \param[in] bl Names of the branches in input to the user function.
+   ///
+   /// Same as `Foreach`, but the user-defined function takes an extra
+   /// `unsigned int` as its first parameter, the *processing slot index*.
+   /// This *slot index* will be assigned a different value, `0` to `poolSize - 1`,
+   /// for each thread of execution.
+   /// This is meant as a helper in writing thread-safe `Foreach`
+   /// actions when using `TDataFrame` after `ROOT::EnableImplicitMT()`.
+   /// The user-defined processing callable is able to follow different
+   /// *streams of processing* indexed by the first parameter.
+   /// `ForeachSlot` works just as well with single-thread execution: in that
+   /// case `slot` will always be `0`.
+   template<typename F>
+   void ForeachSlot(F f, const BranchVec &bl = {}) {
+      auto df = GetDataFrameChecked();
+      const BranchVec &defBl= df->GetDefaultBranches();
+      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
+      const BranchVec &actualBl = Internal::PickBranchVec(nArgs-1, bl, defBl);
+      using DFA_t  = Internal::TDataFrameAction<decltype(f), Proxied>;
+      df->Book(std::make_shared<DFA_t>(f, actualBl, fProxiedPtr));
+      df->Run();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Group entries by the value of a branch, to compute results for each value
+   /// \tparam K The type of the key branch. It must be hashable with `std::hash` and ordered by `<`.
+   /// \param[in] keyBranchName The name of the key branch, e.g. a run number or a module identifier.
+   ///
+   /// Actions booked on the returned object, e.g. `GroupBy<int>("run").Histo("pt", model)`,
+   /// return a `std::map` from each value of the key to the result for the entries
+   /// with that value. All of them run in the same event loop as the other actions,
+   /// whatever the number of distinct keys. See TDataFrameGroupBy.
+   template <typename K>
+   TDataFrameGroupBy<K, Proxied> GroupBy(const std::string &keyBranchName)
+   {
+      return TDataFrameGroupBy<K, Proxied>(*this, keyBranchName);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the number of entries processed (*lazy action*)
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   TActionResultProxy<unsigned int> Count()
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto cShared = std::make_shared<unsigned int>(0);
+      auto c = df->MakeActionResultPtr(cShared);
+      auto cPtr = cShared.get();
+      auto cOp = std::make_shared<Internal::Operations::CountOperation>(cPtr, nSlots);
+      auto countAction = [cOp](unsigned int slot) mutable { cOp->Exec(slot); };
+      BranchVec bl = {};
+      using DFA_t = Internal::TDataFrameAction<decltype(countAction), Proxied>;
+      df->Book(std::shared_ptr<DFA_t>(new DFA_t(countAction, bl, fProxiedPtr)));
+      return c;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the statistics of all named filters of the TDataFrame (*lazy action*)
+   ///
+   /// For each named filter, in booking order, the report holds the number of
+   /// entries the filter was evaluated on, the number of entries it accepted and
+   /// the time spent evaluating it. Since filters are evaluated lazily, a filter is
+   /// only evaluated on entries accepted by all filters upstream and needed by at
+   /// least one action. The statistics are summed over all the event loops run so
+   /// far, including the one triggered by accessing the report, and over all
+   /// processing slots: the time is CPU time, not wall-clock time, when implicit
+   /// multi-threading is active. Unnamed filters are not timed and are not reported,
+   /// their counts are available from GetGraph.
+   ///
+   /// The report is the same whatever node it is requested from.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   TActionResultProxy<TCutFlowReport> Report()
+   {
+      auto df = GetDataFrameChecked();
+      auto repShared = std::make_shared<TCutFlowReport>();
+      auto repOp = std::make_shared<Internal::Operations::ReportOperation>(repShared.get(), df);
+      auto repAction = [repOp](unsigned int) {};
+      BranchVec bl = {};
+      using DFA_t = Internal::TDataFrameAction<decltype(repAction), Details::TDataFrameImpl>;
+      df->Book(std::make_shared<DFA_t>(repAction, bl, df));
+      return df->MakeActionResultPtr(repShared);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the number of distinct values of a branch (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   /// \param[in] precision 0 to count exactly, between 4 and 18 to estimate the count with HyperLogLog.
+   ///
+   /// For collection-type branches, the distinct elements of all collections are counted.
+   /// By default values are counted exactly, which takes memory proportional to the
+   /// number of distinct values. With a non-zero precision `p`, the count is
+   /// instead estimated from 2^p one-byte registers per processing slot, with a
+   /// relative standard error of `1.04 / sqrt(2^p)`: 0.8% for `p = 14`.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<ULong64_t> CountDistinct(const std::string &branchName = "", unsigned int precision = 0)
+   {
+      using Value_t = typename Internal::TDFTraitsUtils::TValueType<T>::Type_t;
+      if (precision != 0 && (precision < 4 || precision > 18))
+         throw std::runtime_error("The precision of CountDistinct must be 0 (exact count) or between 4 and 18.");
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "count the distinct values");
+      auto cShared = std::make_shared<ULong64_t>(0);
+      if (precision == 0) {
+         auto cOp = std::make_shared<Internal::Operations::CountDistinctOperation<Value_t>>(
+            cShared.get(), df->GetActionMemoryBudget(), nSlots);
+         auto countAction = [cOp](unsigned int slot, const T &v) mutable { cOp->Exec(v, slot); };
+         BookFused<T>(countAction, theBranchName);
+      } else {
+         auto cOp = std::make_shared<Internal::Operations::CountDistinctHLLOperation<Value_t>>(cShared.get(), precision,
+                                                                                             nSlots);
+         auto countAction = [cOp](unsigned int slot, const T &v) mutable { cOp->Exec(v, slot); };
+         BookFused<T>(countAction, theBranchName);
+      }
+      return df->MakeActionResultPtr(cShared);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return a collection of values of a branch (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \tparam COLL The type of collection used to store the values.
+   /// \param[in] branchName The name of the branch of which the values are to be collected
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T, typename COLL = std::vector<T>>
+   TActionResultProxy<COLL> Take(const std::string &branchName = "")
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "get the values of the branch");
+      auto valuesPtr = std::make_shared<COLL>();
+      auto values = df->MakeActionResultPtr(valuesPtr);
+      auto getOp = std::make_shared<Internal::Operations::TakeOperation<T,COLL>>(valuesPtr, nSlots);
+      auto getAction = [getOp] (unsigned int slot , const T &v) mutable { getOp->Exec(v, slot); };
+      BookFused<T>(getAction, theBranchName);
+      return values;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the values of a branch, sorted (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \tparam Compare The type of the comparison function.
+   /// \param[in] branchName The name of the branch of which the values are to be collected
+   /// \param[in] compare A function object returning true if its first argument goes before the second
+   ///
+   /// Values are sorted in ascending order according to `compare`, `std::less<T>` by default.
+   /// The values collected by each processing slot are sorted, and the sorted
+   /// runs then merged, in parallel tasks when implicit multi-threading is
+   /// enabled: this is cheaper than sorting the result of Take.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T, typename Compare = std::less<T>>
+   TActionResultProxy<std::vector<T>> TakeSorted(const std::string &branchName = "", Compare compare = Compare())
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "get the values of the branch");
+      auto valuesPtr = std::make_shared<std::vector<T>>();
+      auto values = df->MakeActionResultPtr(valuesPtr);
+      auto takeOp = std::make_shared<Internal::Operations::TakeSortedOperation<T, Compare>>(
+         valuesPtr, compare, df->GetActionMemoryBudget(), nSlots);
+      auto takeAction = [takeOp](unsigned int slot, const T &v) mutable { takeOp->Exec(v, slot); };
+      BookFused<T>(takeAction, theBranchName);
+      return values;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the k largest values of a branch (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \tparam Compare The type of the comparison function.
+   /// \param[in] branchName The name of the branch of which the values are to be collected
+   /// \param[in] k The number of values to return
+   /// \param[in] compare A function object returning true if its first argument is smaller than the second
    ///
-   /// Same as `Foreach`, but the user-defined function takes an extra
-   /// `unsigned int` as its first parameter, the *processing slot index*.
-   /// This *slot index* will be assigned a different value, `0` to `poolSize - 1`,
-   /// for each thread of execution.
-   /// This is meant as a helper in writing thread-safe `Foreach`
-   /// actions when using `TDataFrame` after `ROOT::EnableImplicitMT()`.
-   /// The user-defined processing callable is able to follow different
-   /// *streams of processing* indexed by the first parameter.
-   /// `ForeachSlot` works just as well with single-thread execution: in that
-   /// case `slot` will always be `0`.
-   template<typename F>
-   void ForeachSlot(F f, const BranchVec &bl = {}) {
+   /// The values are returned largest first, according to `compare` (`std::less<T>`
+   /// by default: pass `std::greater<T>()` to get the k smallest values). Only k
+   /// values per processing slot are kept in memory. To select entries rather
+   /// than values, e.g. the events with the highest weights, add a temporary
+   /// branch that bundles the weight with whatever identifies the entry, and
+   /// compare the weights.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T, typename Compare = std::less<T>>
+   TActionResultProxy<std::vector<T>> TopK(const std::string &branchName, std::size_t k, Compare compare = Compare())
+   {
       auto df = GetDataFrameChecked();
-      const BranchVec &defBl= df->GetDefaultBranches();
-      auto nArgs = Internal::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t::fgSize;
-      const BranchVec &actualBl = Internal::PickBranchVec(nArgs-1, bl, defBl);
-      using DFA_t  = Internal::TDataFrameAction<decltype(f), Proxied>;
-      df->Book(std::make_shared<DFA_t>(f, actualBl, fProxiedPtr));
-      df->Run();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "get the largest values of the branch");
+      auto valuesPtr = std::make_shared<std::vector<T>>();
+      auto values = df->MakeActionResultPtr(valuesPtr);
+      auto topKOp = std::make_shared<Internal::Operations::TopKOperation<T, Compare>>(valuesPtr, k, compare, nSlots);
+      auto topKAction = [topKOp](unsigned int slot, const T &v) mutable { topKOp->Exec(v, slot); };
+      BookFused<T>(topKAction, theBranchName);
+      return values;
    }
 
    ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return the number of entries processed (*lazy action*)
+   /// \brief Return a vector of values of a branch, in entry order (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch of which the values are to be collected
+   /// \param[in] efficiency The expected fraction of entries passing the filters, used to size the buffers
+   ///
+   /// Unlike `Take`, the values are ordered as the entries of the TTree also when
+   /// implicit multi-threading is enabled.
+   /// If no filter is applied upstream, each value is written directly at its
+   /// position in a vector preallocated with the number of entries of the TTree.
+   /// Otherwise values are collected per cluster, in buffers sized according to
+   /// `efficiency`, which are concatenated in entry order at the end of the loop.
    ///
    /// This action is *lazy*: upon invocation of this method the calculation is
    /// booked but not executed. See TActionResultProxy documentation.
-   TActionResultProxy<unsigned int> Count()
+   template <typename T>
+   TActionResultProxy<std::vector<T>> TakeOrdered(const std::string &branchName = "", double efficiency = 1.)
    {
       auto df = GetDataFrameChecked();
       unsigned int nSlots = df->GetNSlots();
-      auto cShared = std::make_shared<unsigned int>(0);
-      auto c = df->MakeActionResultPtr(cShared);
-      auto cPtr = cShared.get();
-      auto cOp = std::make_shared<Internal::Operations::CountOperation>(cPtr, nSlots);
-      auto countAction = [cOp](unsigned int slot) mutable { cOp->Exec(slot); };
-      BranchVec bl = {};
-      using DFA_t = Internal::TDataFrameAction<decltype(countAction), Proxied>;
-      df->Book(std::shared_ptr<DFA_t>(new DFA_t(countAction, bl, fProxiedPtr)));
-      return c;
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "get the values of the branch");
+      auto valuesPtr = std::make_shared<std::vector<T>>();
+      auto values = df->MakeActionResultPtr(valuesPtr);
+      const bool isFiltered = Internal::TIsFiltered<Proxied>::fgValue;
+      auto takeOp = std::make_shared<Internal::Operations::TakeOrderedOperation<T>>(valuesPtr, df->GetTree(),
+                                                                                   isFiltered, efficiency, nSlots);
+      auto takeAction = [takeOp](unsigned int slot, const T &v, int entry) mutable { takeOp->Exec(v, slot, entry); };
+      BranchVec bl = {theBranchName, "tdfentry_"};
+      using DFA_t = Internal::TDataFrameAction<decltype(takeAction), Proxied>;
+      df->Book(std::shared_ptr<DFA_t>(new DFA_t(takeAction, bl, fProxiedPtr)));
+      return values;
    }
 
    ////////////////////////////////////////////////////////////////////////////
-   /// \brief Return a collection of values of a branch (*lazy action*)
-   /// \tparam T The type of the branch.
-   /// \tparam COLL The type of collection used to store the values.
+   /// \brief Return the elements of a collection-type branch, stored contiguously (*lazy action*)
+   /// \tparam T The type of the elements of the collections.
+   /// \tparam BranchType The type of the branch.
    /// \param[in] branchName The name of the branch of which the values are to be collected
+   /// \param[in] efficiency The expected fraction of entries passing the filters, used to size the buffers
+   ///
+   /// The elements of all collections are stored in a single vector, in entry
+   /// order, together with the offsets at which the collection of each entry
+   /// starts. See TFlatCollection.
    ///
    /// This action is *lazy*: upon invocation of this method the calculation is
    /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T, typename COLL = std::vector<T>>
-   TActionResultProxy<COLL> Take(const std::string &branchName = "")
+   template <typename T, typename BranchType = std::vector<T>>
+   TActionResultProxy<TFlatCollection<T>> TakeFlat(const std::string &branchName = "", double efficiency = 1.)
    {
       auto df = GetDataFrameChecked();
       unsigned int nSlots = df->GetNSlots();
       auto theBranchName(branchName);
       GetDefaultBranchName(theBranchName, "get the values of the branch");
-      auto valuesPtr = std::make_shared<COLL>();
+      auto valuesPtr = std::make_shared<TFlatCollection<T>>();
       auto values = df->MakeActionResultPtr(valuesPtr);
-      auto getOp = std::make_shared<Internal::Operations::TakeOperation<T,COLL>>(valuesPtr, nSlots);
-      auto getAction = [getOp] (unsigned int slot , const T &v) mutable { getOp->Exec(v, slot); };
-      BranchVec bl = {theBranchName};
-      using DFA_t = Internal::TDataFrameAction<decltype(getAction), Proxied>;
-      df->Book(std::shared_ptr<DFA_t>(new DFA_t(getAction, bl, fProxiedPtr)));
+      auto takeOp = std::make_shared<Internal::Operations::TakeFlatOperation<T, BranchType>>(valuesPtr, df->GetTree(),
+                                                                                            efficiency, nSlots);
+      auto takeAction = [takeOp](unsigned int slot, const BranchType &vs, int entry) mutable {
+         takeOp->Exec(vs, slot, entry);
+      };
+      BranchVec bl = {theBranchName, "tdfentry_"};
+      using DFA_t = Internal::TDataFrameAction<decltype(takeAction), Proxied>;
+      df->Book(std::shared_ptr<DFA_t>(new DFA_t(takeAction, bl, fProxiedPtr)));
       return values;
    }
 
-
    ////////////////////////////////////////////////////////////////////////////
    /// \brief Fill and return a one-dimensional histogram with the values of a branch (*lazy action*)
    /// \tparam T The type of the branch the values of which are used to fill the histogram.
@@ -913,10 +3761,14 @@ public:
    ///
    /// If no branch type is specified, the implementation will try to guess one.
    ///
-   /// If no axes boundaries are specified, all entries are buffered: at the end of
-   /// the loop on the entries, the histogram is filled. If the axis boundaries are
-   /// specified, the histogram (or histograms in the parallel case) are filled. This
-   /// latter mode may result in a reduced memory footprint.
+   /// If no axes boundaries are specified, entries are buffered. If all of them
+   /// fit in the buffers (see SetHistoBufferSize), the axis boundaries are decided
+   /// at the end of the loop on the entries, and the histogram is filled.
+   /// Otherwise, they are decided as soon as a buffer is full, on the basis of the
+   /// values it contains, and the histogram is filled directly from then on: its
+   /// axis is extended if values fall outside of it. If the axis boundaries are
+   /// specified, each processing slot fills a lightweight histogram with the same
+   /// axis, and these are added to the returned TH1F at the end of the loop.
    ///
    /// This action is *lazy*: upon invocation of this method the calculation is
    /// booked but not executed. See TActionResultProxy documentation.
@@ -933,6 +3785,174 @@ public:
       return CreateAction<T, Internal::EActionType::kHisto1D>(theBranchName, h);
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional histogram with the weighted values of a branch (*lazy action*)
+   /// \tparam V The type of the branch the values of which are used to fill the histogram.
+   /// \tparam W The type of the branch the values of which are used as weights.
+   /// \param[in] vName The name of the branch of which the values are to be collected.
+   /// \param[in] wName The name of the branch of which the values are used as weights.
+   /// \param[in] model The model to be copied to build the new return value.
+   ///
+   /// Branch types are not guessed: if they are not specified, they are assumed
+   /// to be `double`. If the values are a collection, the weights can be a collection
+   /// of the same size (one weight per element) or a single value (the same weight
+   /// for all elements, e.g. an event weight).
+   /// The returned histogram is independent of the input one.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V = double, typename W = double>
+   TActionResultProxy<TH1F> Histo(const std::string &vName, const std::string &wName, const TH1F &model)
+   {
+      auto bl = GetDefaultBranchNames({vName, wName}, "fill the histogram");
+      auto h = std::make_shared<TH1F>(model);
+      return CreateAction<Internal::EActionType::kHisto1D, V, W>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional histogram with the weighted values of a branch (*lazy action*)
+   /// \tparam V The type of the branch the values of which are used to fill the histogram.
+   /// \tparam W The type of the branch the values of which are used as weights.
+   /// \param[in] vName The name of the branch of which the values are to be collected.
+   /// \param[in] wName The name of the branch of which the values are used as weights.
+   /// \param[in] nbins The number of bins.
+   /// \param[in] minVal The lower value of the xaxis.
+   /// \param[in] maxVal The upper value of the xaxis.
+   ///
+   /// See the other weighted Histo overload for branch types and collections,
+   /// and the unweighted one for what happens if no axes boundaries are specified:
+   /// weights are buffered together with the values.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename V = double, typename W = double>
+   TActionResultProxy<TH1F> Histo(const std::string &vName, const std::string &wName, int nBins = 128,
+                                double minVal = 0., double maxVal = 0.)
+   {
+      auto bl = GetDefaultBranchNames({vName, wName}, "fill the histogram");
+      auto h = std::make_shared<TH1F>("", "", nBins, minVal, maxVal);
+      if (minVal == maxVal) {
+         h->SetCanExtend(TH1::kAllAxes);
+      }
+      return CreateAction<Internal::EActionType::kHisto1D, V, W>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a two-dimensional histogram with the values of two branches (*lazy action*)
+   /// \tparam X The type of the branch used to fill the x axis.
+   /// \tparam Y The type of the branch used to fill the y axis.
+   /// \param[in] model The model to be copied to build the new return value.
+   /// \param[in] xName The name of the branch used to fill the x axis.
+   /// \param[in] yName The name of the branch used to fill the y axis.
+   ///
+   /// Branch types are not guessed: if they are not specified, they are assumed
+   /// to be `double`. If the branches are collections, they must have the same size
+   /// for each entry and the histogram is filled with pairs of their elements.
+   /// The axis limits of the model are not changed: each processing slot fills
+   /// a copy of the model, and the copies are merged at the end of the loop.
+   /// The returned histogram is independent of the input one.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename X = double, typename Y = double>
+   TActionResultProxy<TH2F> Histo2D(const TH2F &model, const std::string &xName = "", const std::string &yName = "")
+   {
+      auto bl = GetDefaultBranchNames({xName, yName}, "fill the histogram");
+      auto h = std::make_shared<TH2F>(model);
+      return CreateAction<Internal::EActionType::kHisto2D, X, Y>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a three-dimensional histogram with the values of three branches (*lazy action*)
+   /// \tparam X The type of the branch used to fill the x axis.
+   /// \tparam Y The type of the branch used to fill the y axis.
+   /// \tparam Z The type of the branch used to fill the z axis.
+   /// \param[in] model The model to be copied to build the new return value.
+   /// \param[in] xName The name of the branch used to fill the x axis.
+   /// \param[in] yName The name of the branch used to fill the y axis.
+   /// \param[in] zName The name of the branch used to fill the z axis.
+   ///
+   /// See Histo2D: the same rules apply to branch types, collections and axis limits.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename X = double, typename Y = double, typename Z = double>
+   TActionResultProxy<TH3F> Histo3D(const TH3F &model, const std::string &xName = "", const std::string &yName = "",
+                                    const std::string &zName = "")
+   {
+      auto bl = GetDefaultBranchNames({xName, yName, zName}, "fill the histogram");
+      auto h = std::make_shared<TH3F>(model);
+      return CreateAction<Internal::EActionType::kHisto3D, X, Y, Z>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a one-dimensional profile with the values of two branches (*lazy action*)
+   /// \tparam X The type of the branch used to fill the x axis.
+   /// \tparam Y The type of the branch of which the mean is computed in each bin.
+   /// \param[in] model The model to be copied to build the new return value.
+   /// \param[in] xName The name of the branch used to fill the x axis.
+   /// \param[in] yName The name of the branch of which the mean is computed in each bin.
+   ///
+   /// See Histo2D: the same rules apply to branch types, collections and axis limits.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename X = double, typename Y = double>
+   TActionResultProxy<TProfile> Profile1D(const TProfile &model, const std::string &xName = "",
+                                          const std::string &yName = "")
+   {
+      auto bl = GetDefaultBranchNames({xName, yName}, "fill the profile");
+      auto h = std::make_shared<TProfile>(model);
+      return CreateAction<Internal::EActionType::kProfile1D, X, Y>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return a two-dimensional profile with the values of three branches (*lazy action*)
+   /// \tparam X The type of the branch used to fill the x axis.
+   /// \tparam Y The type of the branch used to fill the y axis.
+   /// \tparam Z The type of the branch of which the mean is computed in each bin.
+   /// \param[in] model The model to be copied to build the new return value.
+   /// \param[in] xName The name of the branch used to fill the x axis.
+   /// \param[in] yName The name of the branch used to fill the y axis.
+   /// \param[in] zName The name of the branch of which the mean is computed in each bin.
+   ///
+   /// See Histo2D: the same rules apply to branch types, collections and axis limits.
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename X = double, typename Y = double, typename Z = double>
+   TActionResultProxy<TProfile2D> Profile2D(const TProfile2D &model, const std::string &xName = "",
+                                            const std::string &yName = "", const std::string &zName = "")
+   {
+      auto bl = GetDefaultBranchNames({xName, yName, zName}, "fill the profile");
+      auto h = std::make_shared<TProfile2D>(model);
+      return CreateAction<Internal::EActionType::kProfile2D, X, Y, Z>(bl, h);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill and return any object with a `Fill` and a `Merge` method (*lazy action*)
+   /// \tparam BranchTypes The types of the branches, one per argument of `T::Fill`.
+   /// \tparam T The type of the object, deduced from the model.
+   /// \param[in] model The object to be copied to build the new return value.
+   /// \param[in] branchNames The names of the branches whose values are passed to `T::Fill`.
+   ///
+   /// This works for any copy-constructible object with a `Fill` method taking the
+   /// values of the branches, and a `Merge(TCollection *)` method as ROOT classes
+   /// have, e.g. TEfficiency, THnSparse or user classes: each processing slot fills
+   /// its own copy of the model, and the copies are merged at the end of the loop,
+   /// without any locking. Branch types are not guessed and must be specified.
+   /// If the branches are collections, they must have the same size for each
+   /// entry and `Fill` is called once per element.
+   /// For example `d.Fill<bool, double>(TEfficiency("eff", "eff", 10, 0, 100), {"passed", "pt"})`.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename... BranchTypes, typename T>
+   TActionResultProxy<T> Fill(const T &model, const BranchVec &branchNames = {})
+   {
+      static_assert(sizeof...(BranchTypes) > 0, "the types of the branches used by Fill must be specified");
+      const BranchVec defaultNames(sizeof...(BranchTypes));
+      auto bl = GetDefaultBranchNames(branchNames.empty() ? defaultNames : branchNames, "fill the object");
+      if (bl.size() != sizeof...(BranchTypes))
+         throw std::runtime_error("Fill needs as many branch names as branch types.");
+      auto obj = std::make_shared<T>(model);
+      return CreateAction<Internal::EActionType::kFill, BranchTypes...>(bl, obj);
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    /// \brief Return the minimum of processed branch values (*lazy action*)
    /// \tparam T The type of the branch.
@@ -974,17 +3994,313 @@ public:
    /// \tparam T The type of the branch.
    /// \param[in] branchName The name of the branch to be treated.
    ///
-   /// If no branch type is specified, the implementation will try to guess one.
+   /// If no branch type is specified, the implementation will try to guess one.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Mean(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the mean");
+      auto meanV = std::make_shared<T>(0);
+      return CreateAction<T, Internal::EActionType::kMean>(theBranchName, meanV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the sum of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   /// Values are summed with a compensated (Neumaier) summation, so that the
+   /// result does not depend on the number of threads beyond rounding.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Sum(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the sum");
+      auto sumV = std::make_shared<double>(0);
+      return CreateAction<T, Internal::EActionType::kSum>(theBranchName, sumV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the variance of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   /// The unbiased estimate, with `n - 1` in the denominator, is returned. See
+   /// TStatistics for how it is computed.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> Variance(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the variance");
+      auto varianceV = std::make_shared<double>(0);
+      return CreateAction<T, Internal::EActionType::kVariance>(theBranchName, varianceV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the standard deviation of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   /// This is the square root of the value returned by Variance.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<double> StdDev(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the standard deviation");
+      auto stdDevV = std::make_shared<double>(0);
+      return CreateAction<T, Internal::EActionType::kStdDev>(theBranchName, stdDevV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return number, sum, mean, variance, minimum and maximum of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   ///
+   /// If no branch type is specified, the implementation will try to guess one.
+   /// All quantities are computed in the same pass over the data, see TStatistics.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<TStatistics> Stats(const std::string &branchName = "")
+   {
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the statistics");
+      auto statsV = std::make_shared<TStatistics>();
+      return CreateAction<T, Internal::EActionType::kStats>(theBranchName, statsV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return means and covariance matrix of several branches (*lazy action*)
+   /// \tparam T The type of all branches.
+   /// \param[in] branchNames The names of the branches. If empty, the default branches are used.
+   ///
+   /// All branches must be of the same type, `double` by default. The number of
+   /// branches is not fixed at compile time: the values of each entry are copied
+   /// to an array, and each processing slot updates a packed covariance matrix
+   /// with them. Variables are indexed in the order of `branchNames`. See TCovariance.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<TCovariance> Covariance(const BranchVec &branchNames = {})
+   {
+      auto df = GetDataFrameChecked();
+      const BranchVec &bl = branchNames.empty() ? df->GetDefaultBranches() : branchNames;
+      if (bl.empty()) throw std::runtime_error("No branch in input to Covariance and no default branches.");
+      auto covV = std::make_shared<TCovariance>(bl);
+      auto covOp = std::make_shared<Internal::Operations::CovarianceOperation>(covV.get(), df->GetNSlots());
+      auto covAction = [covOp](unsigned int slot, const T *values) mutable { covOp->Exec(values, slot); };
+      using DFA_t = Internal::TDataFrameArrayAction<T, decltype(covAction), Proxied>;
+      df->Book(std::make_shared<DFA_t>(covAction, bl, fProxiedPtr));
+      return df->MakeActionResultPtr(covV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return quantiles of processed branch values (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch to be treated.
+   /// \param[in] quantiles The probabilities, between 0 and 1, of the quantiles to compute.
+   /// \param[in] compression The accuracy of the estimate, see below.
+   ///
+   /// The quantiles are returned in the same order as the requested probabilities.
+   /// Values are not stored: each processing slot summarizes them in a t-digest,
+   /// a few KB in size, and the digests are merged at the end of the event loop.
+   /// The fraction of values between the estimate of the quantile of probability
+   /// `q` and the exact quantile is at most about `pi * sqrt(q * (1 - q)) / compression`,
+   /// i.e. 0.8% for the median and 0.05% for the 99.9th percentile with the default
+   /// compression, and usually much less. Probabilities 0 and 1 give the exact
+   /// minimum and maximum. Memory and CPU time grow linearly with the compression.
+   ///
+   /// This action is *lazy*: upon invocation of this method the calculation is
+   /// booked but not executed. See TActionResultProxy documentation.
+   template <typename T = double>
+   TActionResultProxy<std::vector<double>> Quantiles(const std::string &branchName,
+                                                     const std::vector<double> &quantiles, double compression = 200)
+   {
+      auto df = GetDataFrameChecked();
+      unsigned int nSlots = df->GetNSlots();
+      auto theBranchName(branchName);
+      GetDefaultBranchName(theBranchName, "calculate the quantiles");
+      if (compression < 20) throw std::runtime_error("The compression of Quantiles must be at least 20.");
+      auto quantilesV = std::make_shared<std::vector<double>>();
+      auto quantilesOp = std::make_shared<Internal::Operations::QuantilesOperation>(quantilesV.get(), quantiles,
+                                                                                    compression, nSlots);
+      auto quantilesAction = [quantilesOp](unsigned int slot, const T &v) mutable { quantilesOp->Exec(v, slot); };
+      BookFused<T>(quantilesAction, theBranchName);
+      return df->MakeActionResultPtr(quantilesV);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Set the maximum number of values buffered by histograms without axis boundaries
+   /// \param[in] bufSize The number of values, summed over all processing slots.
+   ///
+   /// Histograms booked without axis boundaries buffer the values they are filled
+   /// with to decide the boundaries. The default size, 2097152 values, corresponds
+   /// to 16 MB of memory. The setting applies to all histograms booked afterwards
+   /// on this TDataFrame.
+   void SetHistoBufferSize(unsigned int bufSize)
+   {
+      GetDataFrameChecked()->SetHistoBufferSize(bufSize);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Set the memory above which histograms are filled through a single copy of their bins
+   /// \param[in] bytes The memory taken by the per-slot copies of the bins of a histogram, in bytes.
+   ///
+   /// When running in parallel, histograms with axis boundaries are filled through
+   /// one copy of their bins per processing slot. If these copies would take more
+   /// than `bytes` besides the returned histogram, all slots fill instead a single
+   /// copy whose bins are updated with atomic operations: this is slower if slots
+   /// often fill the same bins, but the memory does not grow with the number of
+   /// slots. The default is 256 MB, 0 makes all histograms use a single copy.
+   /// Profiles always use one copy per slot. The setting applies to all histograms
+   /// booked afterwards on this TDataFrame.
+   void SetHistoMemoryThreshold(ULong64_t bytes)
+   {
+      GetDataFrameChecked()->SetHistoMemoryThreshold(bytes);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Set the memory available to the partial results of an action before they are spilled to disk
+   /// \param[in] bytes The memory for the partial results of all processing slots, in bytes. 0 means no limit.
+   ///
+   /// The partial results of CountDistinct (exact count), TakeSorted and of
+   /// GroupBy(...).Aggregate can grow with the number of distinct values or
+   /// entries. When they exceed their share of `bytes`, processing slots write
+   /// them, sorted, to temporary files, which are merged at the end of the event
+   /// loop. This is only done for values that can be copied as raw bytes, i.e.
+   /// trivially copyable types. The result itself is not limited: e.g. the
+   /// vector returned by TakeSorted is still in memory. By default there is no
+   /// limit. The setting applies to all actions booked afterwards on this TDataFrame.
+   void SetActionMemoryBudget(ULong64_t bytes)
+   {
+      GetDataFrameChecked()->SetActionMemoryBudget(bytes);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Let the event loop change the order in which filters are evaluated
+   /// \param[in] reorder Whether filters can be reordered.
+   ///
+   /// By default, chained filters are evaluated in booking order. When
+   /// reordering is enabled, each processing slot evaluates all the filters
+   /// upstream of a node on its first 1000 entries, measuring how often each
+   /// one passes and how long it takes, then evaluates them in order of
+   /// increasing cost per discarded entry. Temporary branches in between do not
+   /// matter, they are computed on demand anyway.
+   ///
+   /// Only enable it if every filter can be evaluated on any entry, i.e. no
+   /// filter relies on another one having passed (e.g. checking that a
+   /// collection is not empty before accessing its first element), and filters
+   /// have no side effects. Results do not change, but the statistics of named
+   /// filters count the entries each filter was actually evaluated on.
+   /// The setting applies to all event loops started afterwards on this TDataFrame.
+   void SetFilterReordering(bool reorder)
+   {
+      GetDataFrameChecked()->SetFilterReordering(reorder);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Time every node of the graph during the event loop
+   /// \param[in] profile Whether to profile the event loop.
+   ///
+   /// When profiling, each processing slot measures the time spent evaluating
+   /// every filter, computing every temporary branch and executing every
+   /// action, as well as the time spent in `TTreeReader::Next`, i.e. in loading
+   /// the entries. Times are exclusive: a temporary branch computed for a
+   /// filter counts for the branch, not for the filter. Reading the value of a
+   /// branch from the file happens the first time a node accesses it, and counts
+   /// for that node. Each slot only updates its own counters, without locks.
+   /// The times are summed over slots and event loops and are part of the
+   /// output of GetGraph. Profiling costs two clock readings per node and entry.
+   /// The setting applies to all event loops started afterwards on this TDataFrame.
+   void SetProfiling(bool profile)
+   {
+      GetDataFrameChecked()->SetProfiling(profile);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Record the timeline of the event loop
+   /// \param[in] trace Whether to record the timeline.
+   ///
+   /// When tracing, each processing slot records, for each task it runs, i.e.
+   /// each cluster of entries when implicit multi-threading is active, the
+   /// start and end of the task, the first entry and the number of entries it
+   /// processed, and the time spent building the readers and looping over the
+   /// entries. The merging of the results of all slots after the loop is
+   /// recorded too. The timeline of the last event loop is returned by GetTrace.
+   /// The setting applies to all event loops started afterwards on this TDataFrame.
+   void SetTracing(bool trace)
+   {
+      GetDataFrameChecked()->SetTracing(trace);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the timeline of the last event loop in the Chrome trace event format
+   ///
+   /// The timeline is recorded if tracing was enabled, see SetTracing, when the
+   /// last event loop started: otherwise it has no events. It can be opened with
+   /// chrome://tracing or https://ui.perfetto.dev, with one track per processing
+   /// slot and one for the merging of results, and shows the load of each slot
+   /// and the clusters which take longer than the others.
+   /// Calling this method does not trigger the event loop.
+   std::string GetTrace()
+   {
+      return GetDataFrameChecked()->GetTrace();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the statistics of the last event loop
+   ///
+   /// The statistics are the number of entries read, in total and by each
+   /// processing slot, the compressed bytes read from the files, the bytes
+   /// they amount to once decompressed, and the wall-clock and CPU times of the
+   /// event loop, from which the throughput in entries per second follows.
+   /// The CPU time is the one of the whole process, including all threads.
+   /// TRunStats::AsJson returns them as a JSON object, e.g. to be fed to a
+   /// monitoring system. Before the first event loop all statistics are zero.
+   /// Calling this method does not trigger the event loop.
+   TRunStats GetRunStats()
+   {
+      return GetDataFrameChecked()->GetRunStats();
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the graph of filters, temporary branches and actions of the TDataFrame
+   /// \param[in] format "dot" for the dot language of Graphviz, or "json".
+   ///
+   /// The graph is the whole one, whatever node it is requested from. Each node
+   /// carries the number of entries it processed: entries read for the
+   /// TDataFrame, evaluations for filters and temporary branches, entries
+   /// accepted by all their filters for actions. Filters also carry the number
+   /// of entries they accepted and, for named filters, the time spent evaluating
+   /// them, in seconds. When profiling, see SetProfiling, all nodes carry their
+   /// time, the one of the TDataFrame being spent in `TTreeReader::Next`. Counts add up over all event loops run so far, except for
+   /// actions, which are those of the last event loop followed by those booked since.
    ///
-   /// This action is *lazy*: upon invocation of this method the calculation is
-   /// booked but not executed. See TActionResultProxy documentation.
-   template <typename T = double>
-   TActionResultProxy<double> Mean(const std::string &branchName = "")
+   /// Calling this method does not trigger the event loop. The output can be
+   /// rendered with e.g. `dot -Tpdf graph.dot -o graph.pdf`.
+   std::string GetGraph(const std::string &format = "dot")
    {
-      auto theBranchName(branchName);
-      GetDefaultBranchName(theBranchName, "calculate the mean");
-      auto meanV = std::make_shared<T>(0);
-      return CreateAction<T, Internal::EActionType::kMean>(theBranchName, meanV);
+      auto nodes = GetDataFrameChecked()->GetGraphNodes();
+      if (format == "dot") return Internal::GraphToDot(nodes);
+      if (format == "json") return Internal::GraphToJson(nodes);
+      throw std::runtime_error("Unknown graph format \"" + format + "\": expected \"dot\" or \"json\".");
    }
 
 private:
@@ -1019,9 +4335,136 @@ private:
       }
    }
 
+   /// Return the branch names, or the default branches if no name is specified. Throw if that is not possible.
+   BranchVec GetDefaultBranchNames(const BranchVec &branchNames, const std::string &actionNameForErr)
+   {
+      auto isEmpty = [](const std::string &name) { return name.empty(); };
+      if (std::none_of(branchNames.begin(), branchNames.end(), isEmpty)) return branchNames;
+      const BranchVec &defBl = GetDataFrameChecked()->GetDefaultBranches();
+      if (std::all_of(branchNames.begin(), branchNames.end(), isEmpty) && defBl.size() == branchNames.size())
+         return defBl;
+      std::string msg("Missing branch names in input to ");
+      msg += actionNameForErr;
+      msg += " and default branch list has size ";
+      msg += std::to_string(defBl.size());
+      msg += ", need ";
+      msg += std::to_string(branchNames.size());
+      throw std::runtime_error(msg);
+   }
+
+   /// Book an action on a single branch. It is fused with the actions already
+   /// booked on the same branch of this node, if any, which read the same value.
+   template <typename T, typename F>
+   void BookFused(F action, const std::string &branchName)
+   {
+      auto df = GetDataFrameChecked();
+      using DFFA_t = Internal::TDataFrameFusedAction<T, Proxied>;
+      for (auto &bookedAction : df->GetBookedActions()) {
+         auto fusedAction = std::dynamic_pointer_cast<DFFA_t>(bookedAction);
+         if (fusedAction && fusedAction->IsOn(branchName, fProxiedPtr.get())) {
+            fusedAction->AddAction(action);
+            return;
+         }
+      }
+      auto fusedAction = std::make_shared<DFFA_t>(branchName, fProxiedPtr);
+      fusedAction->AddAction(action);
+      df->Book(fusedAction);
+   }
+
    template <typename BranchType, typename ActionResultType, enum Internal::EActionType, typename ThisType>
    struct SimpleAction {};
 
+   // Actions on several branches, e.g. Histo2D: one FillTOOperation or FillSharedOperation per action
+   template <typename... BranchTypes, typename ActionResultType, Internal::EActionType ActionType, typename ThisType>
+   struct SimpleAction<Internal::TDFTraitsUtils::TTypeList<BranchTypes...>, ActionResultType, ActionType, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const BranchVec &bl,
+                                                             std::shared_ptr<ActionResultType> h, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         if (Internal::Operations::UseSharedHisto(*h, false, nSlots, df->GetHistoMemoryThreshold())) {
+            auto fillOp = std::make_shared<Internal::Operations::FillSharedOperation>(h, false, nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchTypes &... vs) mutable {
+               fillOp->template Exec<BranchTypes...>(vs..., slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         } else {
+            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<ActionResultType>>(h);
+            auto fillLambda = [fillTOOp](unsigned int slot, const BranchTypes &... vs) mutable {
+               fillTOOp->template Exec<BranchTypes...>(vs..., slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         }
+         return df->MakeActionResultPtr(h);
+      }
+   };
+
+   // Any object with Fill and Merge methods: always one copy per slot
+   template <typename... BranchTypes, typename ActionResultType, typename ThisType>
+   struct SimpleAction<Internal::TDFTraitsUtils::TTypeList<BranchTypes...>, ActionResultType,
+                       Internal::EActionType::kFill, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const BranchVec &bl,
+                                                             std::shared_ptr<ActionResultType> obj, unsigned int)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto df = thisFrame->GetDataFrameChecked();
+         auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<ActionResultType>>(obj);
+         auto fillLambda = [fillTOOp](unsigned int slot, const BranchTypes &... vs) mutable {
+            fillTOOp->template Exec<BranchTypes...>(vs..., slot);
+         };
+         using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+         df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         return df->MakeActionResultPtr(obj);
+      }
+   };
+
+   // Weighted one-dimensional histograms
+   template <typename BranchType, typename WeightType, typename ThisType>
+   struct SimpleAction<Internal::TDFTraitsUtils::TTypeList<BranchType, WeightType>, TH1F,
+                       Internal::EActionType::kHisto1D, ThisType> {
+      static TActionResultProxy<TH1F> BuildAndBook(ThisType thisFrame, const BranchVec &bl, std::shared_ptr<TH1F> h,
+                                                 unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why these are shared_ptrs
+         auto df = thisFrame->GetDataFrameChecked();
+         auto xaxis = h->GetXaxis();
+         auto hasAxisLimits = !(xaxis->GetXmin() == 0. && xaxis->GetXmax() == 0.);
+
+         if (hasAxisLimits && Internal::Operations::UseSharedHisto(*h, true, nSlots, df->GetHistoMemoryThreshold())) {
+            auto fillOp = std::make_shared<Internal::Operations::FillSharedOperation>(h, true, nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v, const WeightType &w) mutable {
+               fillOp->template Exec<BranchType, WeightType>(v, w, slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         } else if (hasAxisLimits && Internal::Operations::TLightHisto1D<float>::CanFill(*h)) {
+            auto fillOp = std::make_shared<Internal::Operations::FillLightOperation>(h, nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v, const WeightType &w) mutable {
+               fillOp->template Exec<BranchType, WeightType>(v, w, slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         } else if (hasAxisLimits) {
+            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<TH1F>>(h);
+            auto fillLambda = [fillTOOp](unsigned int slot, const BranchType &v, const WeightType &w) mutable {
+               fillTOOp->template Exec<BranchType, WeightType>(v, w, slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         } else {
+            auto fillOp = std::make_shared<Internal::Operations::FillOperation>(h, df->GetHistoBufferSize(), nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v, const WeightType &w) mutable {
+               fillOp->Exec(v, w, slot);
+            };
+            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
+            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         }
+         return df->MakeActionResultPtr(h);
+      }
+   };
+
    template <typename BranchType, typename ThisType>
    struct SimpleAction<BranchType, TH1F, Internal::EActionType::kHisto1D, ThisType> {
       static TActionResultProxy<TH1F> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
@@ -1031,21 +4474,32 @@ private:
          // and therefore of the TDataFrameAction that contains it: merging of results
          // from different threads is performed in the operation's destructor, at the
          // moment when the TDataFrameAction is deleted by TDataFrameImpl
-         BranchVec bl = {theBranchName};
          auto df = thisFrame->GetDataFrameChecked();
          auto xaxis = h->GetXaxis();
          auto hasAxisLimits = !(xaxis->GetXmin() == 0. && xaxis->GetXmax() == 0.);
 
-         if (hasAxisLimits) {
-            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation>(h, nSlots);
-            auto fillLambda = [fillTOOp](unsigned int slot, const BranchType &v) mutable { fillTOOp->Exec(v, slot); };
-            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
-            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+         if (hasAxisLimits && Internal::Operations::UseSharedHisto(*h, false, nSlots, df->GetHistoMemoryThreshold())) {
+            auto fillOp = std::make_shared<Internal::Operations::FillSharedOperation>(h, false, nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v) mutable {
+               fillOp->template Exec<BranchType>(v, slot);
+            };
+            thisFrame->template BookFused<BranchType>(fillLambda, theBranchName);
+         } else if (hasAxisLimits && Internal::Operations::TLightHisto1D<float>::CanFill(*h)) {
+            auto fillOp = std::make_shared<Internal::Operations::FillLightOperation>(h, nSlots);
+            auto fillLambda = [fillOp](unsigned int slot, const BranchType &v) mutable {
+               fillOp->template Exec<BranchType>(v, slot);
+            };
+            thisFrame->template BookFused<BranchType>(fillLambda, theBranchName);
+         } else if (hasAxisLimits) {
+            auto fillTOOp = std::make_shared<Internal::Operations::FillTOOperation<TH1F>>(h);
+            auto fillLambda = [fillTOOp](unsigned int slot, const BranchType &v) mutable {
+               fillTOOp->template Exec<BranchType>(v, slot);
+            };
+            thisFrame->template BookFused<BranchType>(fillLambda, theBranchName);
          } else {
-            auto fillOp = std::make_shared<Internal::Operations::FillOperation>(h, nSlots);
+            auto fillOp = std::make_shared<Internal::Operations::FillOperation>(h, df->GetHistoBufferSize(), nSlots);
             auto fillLambda = [fillOp](unsigned int slot, const BranchType &v) mutable { fillOp->Exec(v, slot); };
-            using DFA_t = Internal::TDataFrameAction<decltype(fillLambda), Proxied>;
-            df->Book(std::make_shared<DFA_t>(fillLambda, bl, thisFrame->fProxiedPtr));
+            thisFrame->template BookFused<BranchType>(fillLambda, theBranchName);
          }
          return df->MakeActionResultPtr(h);
       }
@@ -1059,10 +4513,8 @@ private:
          // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
          auto minOp = std::make_shared<Internal::Operations::MinOperation>(minV.get(), nSlots);
          auto minOpLambda = [minOp](unsigned int slot, const BranchType &v) mutable { minOp->Exec(v, slot); };
-         BranchVec bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(minOpLambda), Proxied>;
+         thisFrame->template BookFused<BranchType>(minOpLambda, theBranchName);
          auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(minOpLambda, bl, thisFrame->fProxiedPtr));
          return df->MakeActionResultPtr(minV);
       }
    };
@@ -1075,10 +4527,8 @@ private:
          // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
          auto maxOp = std::make_shared<Internal::Operations::MaxOperation>(maxV.get(), nSlots);
          auto maxOpLambda = [maxOp](unsigned int slot, const BranchType &v) mutable { maxOp->Exec(v, slot); };
-         BranchVec bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(maxOpLambda), Proxied>;
+         thisFrame->template BookFused<BranchType>(maxOpLambda, theBranchName);
          auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(maxOpLambda, bl, thisFrame->fProxiedPtr));
          return df->MakeActionResultPtr(maxV);
       }
    };
@@ -1091,14 +4541,78 @@ private:
          // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
          auto meanOp = std::make_shared<Internal::Operations::MeanOperation>(meanV.get(), nSlots);
          auto meanOpLambda = [meanOp](unsigned int slot, const BranchType &v) mutable { meanOp->Exec(v, slot); };
-         BranchVec bl = {theBranchName};
-         using DFA_t = Internal::TDataFrameAction<decltype(meanOpLambda), Proxied>;
+         thisFrame->template BookFused<BranchType>(meanOpLambda, theBranchName);
          auto df = thisFrame->GetDataFrameChecked();
-         df->Book(std::make_shared<DFA_t>(meanOpLambda, bl, thisFrame->fProxiedPtr));
          return df->MakeActionResultPtr(meanV);
       }
    };
 
+   template <typename BranchType, typename ActionResultType, typename ThisType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kSum, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> sumV, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto sumOp = std::make_shared<Internal::Operations::SumOperation>(sumV.get(), nSlots);
+         auto sumOpLambda = [sumOp](unsigned int slot, const BranchType &v) mutable { sumOp->Exec(v, slot); };
+         thisFrame->template BookFused<BranchType>(sumOpLambda, theBranchName);
+         auto df = thisFrame->GetDataFrameChecked();
+         return df->MakeActionResultPtr(sumV);
+      }
+   };
+
+   template <typename BranchType, typename ActionResultType, typename ThisType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kVariance, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> varianceV,
+                                                             unsigned int nSlots)
+      {
+         return BookVariance(thisFrame, theBranchName, varianceV, false, nSlots);
+      }
+
+      // also used for StdDev, which only differs in the final result
+      static TActionResultProxy<ActionResultType> BookVariance(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> varianceV,
+                                                             bool isStdDev, unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto varianceOp =
+            std::make_shared<Internal::Operations::VarianceOperation>(varianceV.get(), isStdDev, nSlots);
+         auto varianceOpLambda = [varianceOp](unsigned int slot, const BranchType &v) mutable {
+            varianceOp->Exec(v, slot);
+         };
+         thisFrame->template BookFused<BranchType>(varianceOpLambda, theBranchName);
+         auto df = thisFrame->GetDataFrameChecked();
+         return df->MakeActionResultPtr(varianceV);
+      }
+   };
+
+   template <typename BranchType, typename ActionResultType, typename ThisType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kStdDev, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> stdDevV,
+                                                             unsigned int nSlots)
+      {
+         return SimpleAction<BranchType, ActionResultType, Internal::EActionType::kVariance,
+                             ThisType>::BookVariance(thisFrame, theBranchName, stdDevV, true, nSlots);
+      }
+   };
+
+   template <typename BranchType, typename ActionResultType, typename ThisType>
+   struct SimpleAction<BranchType, ActionResultType, Internal::EActionType::kStats, ThisType> {
+      static TActionResultProxy<ActionResultType> BuildAndBook(ThisType thisFrame, const std::string &theBranchName,
+                                                             std::shared_ptr<ActionResultType> statsV,
+                                                             unsigned int nSlots)
+      {
+         // see "TActionResultProxy<TH1F> BuildAndBook" for why this is a shared_ptr
+         auto statsOp = std::make_shared<Internal::Operations::StatsOperation>(statsV.get(), nSlots);
+         auto statsOpLambda = [statsOp](unsigned int slot, const BranchType &v) mutable { statsOp->Exec(v, slot); };
+         thisFrame->template BookFused<BranchType>(statsOpLambda, theBranchName);
+         auto df = thisFrame->GetDataFrameChecked();
+         return df->MakeActionResultPtr(statsV);
+      }
+   };
+
    template <typename BranchType, Internal::EActionType ActionType, typename ActionResultType>
    TActionResultProxy<ActionResultType> CreateAction(const std::string & theBranchName,
                                                    std::shared_ptr<ActionResultType> r)
@@ -1163,13 +4677,117 @@ private:
       return SimpleAction<BranchType, ART_t, at, TT_t>::BuildAndBook(this, theBranchName, r, nSlots);
    }
 
+   // Branch types are not guessed for actions on several branches: trying out
+   // all combinations of common types would make compilation too expensive
+   template <Internal::EActionType ActionType, typename... BranchTypes, typename ActionResultType>
+   TActionResultProxy<ActionResultType> CreateAction(const BranchVec &bl, std::shared_ptr<ActionResultType> r)
+   {
+      using BT_t = Internal::TDFTraitsUtils::TTypeList<BranchTypes...>;
+      auto df = GetDataFrameChecked();
+      return SimpleAction<BT_t, ActionResultType, ActionType, decltype(this)>::BuildAndBook(this, bl, r,
+                                                                                          df->GetNSlots());
+   }
+
    std::shared_ptr<Proxied> fProxiedPtr;
 };
 
 using TDataFrame = TDataFrameInterface<ROOT::Details::TDataFrameImpl>;
 
+/**
+* \class ROOT::TDataFrameGroupBy
+* \brief Books actions whose results are computed separately for each value of a key branch
+* \tparam K The type of the key branch.
+* \tparam Proxied The node of the call graph the actions are attached to. The user never specifies this type manually.
+*
+* Returned by TDataFrameInterface::GroupBy. Each processing slot keeps its
+* partial results in a hash table with open addressing, indexed by key; the
+* tables are merged at the end of the event loop. Results are returned in a
+* `std::map` sorted by key. All actions are *lazy*, see TActionResultProxy.
+*/
+template <typename K, typename Proxied>
+class TDataFrameGroupBy {
+   TDataFrameInterface<Proxied> fInterface;
+   std::string fKeyBranchName;
+
+   template <typename T, typename Op>
+   void Book(std::shared_ptr<Op> op, const std::string &branchName)
+   {
+      auto df = fInterface.GetDataFrameChecked();
+      auto action = [op](unsigned int slot, const K &key, const T &v) mutable { op->Exec(key, v, slot); };
+      BranchVec bl = {fKeyBranchName, branchName};
+      using DFA_t = Internal::TDataFrameAction<decltype(action), Proxied>;
+      df->Book(std::make_shared<DFA_t>(action, bl, fInterface.fProxiedPtr));
+   }
+
+public:
+   TDataFrameGroupBy(const TDataFrameInterface<Proxied> &interface, const std::string &keyBranchName)
+      : fInterface(interface), fKeyBranchName(keyBranchName) {}
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Accumulate the values of a branch for each key (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] acc A function with signature `R(R, T)`, returning the accumulator updated with a value.
+   /// \param[in] merge A function with signature `R(R, R)`, combining two accumulators of the same key.
+   /// \param[in] branchName The name of the branch of which the values are accumulated.
+   /// \param[in] init The value of the accumulator of a key before the first value is accumulated.
+   ///
+   /// For example, `Aggregate([](double s, double x) { return s + x; }, std::plus<double>(), "x")`
+   /// sums `x` for each key.
+   ///
+   /// With implicit multi-threading, the accumulators of the threads are merged
+   /// in parallel tasks: `merge` can be called concurrently for different keys.
+   template <typename T = double, typename Acc, typename Merge,
+             typename R = typename std::decay<typename Internal::TDFTraitsUtils::TFunctionTraits<Acc>::RetType_t>::type>
+   TActionResultProxy<std::map<K, R>> Aggregate(Acc acc, Merge merge, const std::string &branchName = "",
+                                                const R &init = R())
+   {
+      auto theBranchName(branchName);
+      fInterface.GetDefaultBranchName(theBranchName, "aggregate the values of the branch");
+      auto df = fInterface.GetDataFrameChecked();
+      auto resultPtr = std::make_shared<std::map<K, R>>();
+      using Op_t = Internal::Operations::AggregateByKeyOperation<K, T, R, Acc, Merge>;
+      Book<T>(std::make_shared<Op_t>(resultPtr, acc, merge, init, df->GetActionMemoryBudget(), df->GetNSlots()),
+              theBranchName);
+      return df->MakeActionResultPtr(resultPtr);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Return the number of entries for each key (*lazy action*)
+   TActionResultProxy<std::map<K, ULong64_t>> Count()
+   {
+      return Aggregate<K>([](ULong64_t n, const K &) { return n + 1; }, std::plus<ULong64_t>(), fKeyBranchName);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   /// \brief Fill a histogram with the values of a branch for each key (*lazy action*)
+   /// \tparam T The type of the branch.
+   /// \param[in] branchName The name of the branch of which the values are to be histogrammed. If empty, the default
+   /// branch is used.
+   /// \param[in] model The model to be considered to build the histograms of all keys.
+   ///
+   /// The histograms of all keys have the binning of the model. The axis must
+   /// have limits: a histogram is created in a processing slot the first time
+   /// the slot sees its key.
+   template <typename T = double>
+   TActionResultProxy<std::map<K, TH1F>> Histo(const std::string &branchName, const TH1F &model)
+   {
+      if (model.GetXaxis()->GetXmax() == model.GetXaxis()->GetXmin())
+         throw std::runtime_error("Histograms grouped by key need a model with axis limits.");
+      auto theBranchName(branchName);
+      fInterface.GetDefaultBranchName(theBranchName, "fill the histograms of the keys");
+      auto df = fInterface.GetDataFrameChecked();
+      auto resultPtr = std::make_shared<std::map<K, TH1F>>();
+      using Op_t = Internal::Operations::HistoByKeyOperation<K>;
+      Book<T>(std::make_shared<Op_t>(resultPtr, model, df->GetNSlots()), theBranchName);
+      return df->MakeActionResultPtr(resultPtr);
+   }
+};
+
 namespace Details {
 
+class TDataFrameFilterBase;
+using FilterChain_t = std::vector<TDataFrameFilterBase *>;
+
 class TDataFrameBranchBase {
 public:
    virtual ~TDataFrameBranchBase() {}
@@ -1178,30 +4796,88 @@ public:
    virtual std::string GetName() const       = 0;
    virtual void *GetValue(unsigned int slot, int entry) = 0;
    virtual const std::type_info &GetTypeId() const = 0;
+   virtual Internal::TGraphNode GetGraphNode() const = 0;
 };
 using TmpBranchBasePtr_t = std::shared_ptr<TDataFrameBranchBase>;
 
+// The "tdfentry_" temporary branch, booked in every TDataFrameImpl: its value is
+// the number of the entry being processed
+class TDataFrameEntryBranch final : public TDataFrameBranchBase {
+   std::vector<int> fEntries;
+
+public:
+   void BuildReaderValues(TTreeReader &, unsigned int) {}
+   void CreateSlots(unsigned int nSlots) { fEntries.resize(nSlots); }
+   std::string GetName() const { return "tdfentry_"; }
+   void *GetValue(unsigned int slot, int entry)
+   {
+      fEntries[slot] = entry;
+      return static_cast<void *>(&fEntries[slot]);
+   }
+   const std::type_info &GetTypeId() const { return typeid(int); }
+   // not shown in the graph
+   Internal::TGraphNode GetGraphNode() const { return Internal::TGraphNode("", GetName(), 0, 0); }
+};
+
+// The expression of a temporary branch, its inputs and the values of each slot,
+// which do not depend on the nodes upstream. Branches computing the same
+// expression on the same inputs share their values, evaluated once per entry,
+// wherever they are in the graph.
+template <typename F>
+class TDataFrameBranchExpression : public TDataFrameBranchBase {
+protected:
+   using RetType_t = typename Internal::TDFTraitsUtils::TFunctionTraits<F>::RetType_t;
+   struct TSlotValues {
+      std::vector<ROOT::Internal::TVBVec_t> fReaderValues;
+      std::vector<std::shared_ptr<RetType_t>> fLastResultPtr;
+      std::vector<int> fLastCheckedEntry = {-1};
+   };
+
+   F fExpression;
+   const BranchVec fBranches;
+   std::shared_ptr<TSlotValues> fValues = std::make_shared<TSlotValues>();
+
+   TDataFrameBranchExpression(F expression, const BranchVec &bl) : fExpression(expression), fBranches(bl) {}
+
+public:
+   // Whether this branch computes the same values as a branch built from these arguments
+   bool IsSameExpression(const F &expression, const BranchVec &bl) const
+   {
+      return bl == fBranches && Internal::AreSameCallables(expression, fExpression);
+   }
+
+   void ShareValuesWith(const TDataFrameBranchExpression &other) { fValues = other.fValues; }
+
+   void CreateSlots(unsigned int nSlots)
+   {
+      fValues->fReaderValues.resize(nSlots);
+      // no entry cached, also for slots added since the last event loop
+      fValues->fLastCheckedEntry.assign(nSlots, -1);
+      fValues->fLastResultPtr.resize(nSlots);
+   }
+};
+
 template <typename F, typename PrevData>
-class TDataFrameBranch final : public TDataFrameBranchBase {
+class TDataFrameBranch final : public TDataFrameBranchExpression<F> {
    using BranchTypes_t = typename Internal
    ::TDFTraitsUtils::TFunctionTraits<F>::ArgTypes_t;
    using TypeInd_t = typename Internal::TDFTraitsUtils::TGenStaticSeq<BranchTypes_t::fgSize>::Type_t;
-   using RetType_t = typename Internal::TDFTraitsUtils::TFunctionTraits<F>::RetType_t;
+   using typename TDataFrameBranchExpression<F>::RetType_t;
 
    const std::string fName;
-   F fExpression;
-   const BranchVec fBranches;
    BranchVec fTmpBranches;
-   std::vector<ROOT::Internal::TVBVec_t> fReaderValues;
-   std::vector<std::shared_ptr<RetType_t>> fLastResultPtr;
    std::weak_ptr<TDataFrameImpl> fFirstData;
    PrevData *fPrevData;
-   std::vector<int> fLastCheckedEntry = {-1};
+   const FilterChain_t fFilterChain;
+   const unsigned int fGraphId;
+   std::vector<Internal::TNodeSlotStats> fStats;
+   Internal::TSlotProfiler *fProfilers = nullptr; // null unless profiling
 
 public:
    TDataFrameBranch(const std::string &name, F expression, const BranchVec &bl, std::shared_ptr<PrevData> pd)
-      : fName(name), fExpression(expression), fBranches(bl), fTmpBranches(pd->GetTmpBranches()),
-        fFirstData(pd->GetDataFrame()), fPrevData(pd.get())
+      : TDataFrameBranchExpression<F>(expression, bl), fName(name), fTmpBranches(pd->GetTmpBranches()),
+        fFirstData(pd->GetDataFrame()), fPrevData(pd.get()), fFilterChain(pd->GetFilterChain()),
+        fGraphId(pd->GetDataFrame().lock()->NewGraphId())
    {
       fTmpBranches.emplace_back(name);
    }
@@ -1212,29 +4888,49 @@ public:
 
    BranchVec GetTmpBranches() const { return fTmpBranches; }
 
+   FilterChain_t GetFilterChain() const { return fFilterChain; }
+
+   unsigned int GetGraphId() const { return fGraphId; }
+
+   bool IsSameNode(const std::string &name, const F &expression, const BranchVec &bl, const PrevData *pd) const
+   {
+      return name == fName && pd == fPrevData && this->IsSameExpression(expression, bl);
+   }
+
    void BuildReaderValues(TTreeReader &r, unsigned int slot)
    {
-      fReaderValues[slot] = Internal::BuildReaderValues(r, fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
+      this->fValues->fReaderValues[slot] =
+         Internal::BuildReaderValues(r, this->fBranches, fTmpBranches, BranchTypes_t(), TypeInd_t());
    }
 
    void *GetValue(unsigned int slot, int entry)
    {
-      if (entry != fLastCheckedEntry[slot]) {
-         // evaluate this filter, cache the result
+      auto &values = *this->fValues;
+      if (entry != values.fLastCheckedEntry[slot]) {
+         // evaluate this branch, cache the result
+         ++fStats[slot].fAll;
+         const Internal::TProfiledRegion region(fProfilers ? &fProfilers[slot] : nullptr, fStats[slot].fTime);
          auto newValuePtr = GetValueHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
-         fLastResultPtr[slot] = newValuePtr;
-         fLastCheckedEntry[slot] = entry;
+         values.fLastResultPtr[slot] = newValuePtr;
+         values.fLastCheckedEntry[slot] = entry;
       }
-      return static_cast<void *>(fLastResultPtr[slot].get());
+      return static_cast<void *>(values.fLastResultPtr[slot].get());
    }
 
    const std::type_info &GetTypeId() const { return typeid(RetType_t); }
 
    void CreateSlots(unsigned int nSlots)
    {
-      fReaderValues.resize(nSlots);
-      fLastCheckedEntry.resize(nSlots);
-      fLastResultPtr.resize(nSlots);
+      TDataFrameBranchExpression<F>::CreateSlots(nSlots);
+      fStats.resize(nSlots);
+      fProfilers = fPrevData->GetDataFrame().lock()->GetSlotProfilers();
+   }
+
+   Internal::TGraphNode GetGraphNode() const
+   {
+      Internal::TGraphNode node("AddBranch", fName, fGraphId, fPrevData->GetGraphId());
+      node.AddStats(fStats, fProfilers);
+      return node;
    }
 
    bool CheckFilters(unsigned int slot, int entry)
@@ -1250,8 +4946,9 @@ public:
                                              Internal::TDFTraitsUtils::TStaticSeq<S...>,
                                              unsigned int slot, int entry)
    {
-      auto valuePtr = std::make_shared<RetType_t>(fExpression(
-         Internal::GetBranchValue<S, BranchTypes>(fReaderValues[slot][S], slot, entry, fBranches[S], fFirstData)...));
+      auto &readerValues = this->fValues->fReaderValues[slot];
+      auto valuePtr = std::make_shared<RetType_t>(this->fExpression(
+         Internal::GetBranchValue<S, BranchTypes>(readerValues[S], slot, entry, this->fBranches[S], fFirstData)...));
       return valuePtr;
    }
 };
@@ -1261,7 +4958,14 @@ public:
    virtual ~TDataFrameFilterBase() {}
    virtual void BuildReaderValues(TTreeReader &r, unsigned int slot) = 0;
    virtual void CreateSlots(unsigned int nSlots) = 0;
+   virtual void FillReport(TCutFlowReport &rep) const = 0;
+   virtual Internal::TGraphNode GetGraphNode() const = 0;
+   // evaluate this filter alone, regardless of the filters upstream. Only used when reordering filters.
+   virtual bool CheckOwnFilter(unsigned int slot, int entry, bool measure) = 0;
+   // the expected cost of evaluating this filter first, per entry it discards. Only used when reordering filters.
+   virtual double GetRank(unsigned int slot) const = 0;
 };
+
 using FilterBasePtr_t = std::shared_ptr<TDataFrameFilterBase>;
 using FilterBaseVec_t = std::vector<FilterBasePtr_t>;
 
@@ -1278,33 +4982,135 @@ class TDataFrameFilter final : public TDataFrameFilterBase {
    std::vector<Internal::TVBVec_t> fReaderValues = {};
    std::vector<int> fLastCheckedEntry = {-1};
    std::vector<int> fLastResult = {true}; // std::vector<bool> cannot be used in a MT context safely
+   const std::string fName; // empty for unnamed filters, which are not timed
+   // of all evaluations, for the graph and the report: timed for named filters and while profiling
+   std::vector<Internal::TNodeSlotStats> fStats;
+   Internal::TSlotProfiler *fProfilers = nullptr; // null unless profiling
+   // this filter and the filters upstream of it, in booking order
+   const FilterChain_t fChain;
+   const unsigned int fGraphId;
+   // when reordering filters: the order in which each slot evaluates fChain,
+   // the entries sampled so far, the statistics of this filter on the sampled
+   // entries of the current run, and the cached result of this filter alone
+   bool fReorder = false;
+   std::vector<FilterChain_t> fOrder;
+   std::vector<unsigned int> fNSampled;
+   std::vector<Internal::TNodeSlotStats> fSampleStats;
+   std::vector<int> fLastOwnCheckedEntry;
+   std::vector<int> fLastOwnResult;
+   static constexpr unsigned int fgNSampledEntries = 1000;
+
+   bool EvaluateFilter(unsigned int slot, int entry)
+   {
+      auto &stats = fStats[slot];
+      bool pass;
+      if (!fName.empty() && !fProfilers) {
+         // the time of the temporary branches computed by the filter is included
+         const auto start = std::chrono::steady_clock::now();
+         pass = CheckFilterHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
+         stats.fTime += std::chrono::steady_clock::now() - start;
+      } else {
+         const Internal::TProfiledRegion region(fProfilers ? &fProfilers[slot] : nullptr, stats.fTime);
+         pass = CheckFilterHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
+      }
+      ++stats.fAll;
+      if (pass) ++stats.fPass;
+      return pass;
+   }
 
 public:
-   TDataFrameFilter(FilterF f, const BranchVec &bl, std::shared_ptr<PrevDataFrame> pd)
+   TDataFrameFilter(FilterF f, const BranchVec &bl, std::shared_ptr<PrevDataFrame> pd, const std::string &name = "")
       : fFilter(f), fBranches(bl), fTmpBranches(pd->GetTmpBranches()), fPrevData(pd.get()),
-        fFirstData(pd->GetDataFrame()) { }
+        fFirstData(pd->GetDataFrame()), fName(name), fChain(AppendToChain(pd->GetFilterChain(), this)),
+        fGraphId(pd->GetDataFrame().lock()->NewGraphId()) { }
 
    std::weak_ptr<TDataFrameImpl> GetDataFrame() const { return fFirstData; }
 
    BranchVec GetTmpBranches() const { return fTmpBranches; }
 
+   FilterChain_t GetFilterChain() const { return fChain; }
+
+   unsigned int GetGraphId() const { return fGraphId; }
+
+   // Whether this filter is equivalent to a filter built from these arguments
+   bool IsSameNode(const FilterF &f, const BranchVec &bl, const PrevDataFrame *pd, const std::string &name) const
+   {
+      return pd == fPrevData && name == fName && bl == fBranches && Internal::AreSameCallables(f, fFilter);
+   }
+
    TDataFrameFilter(const TDataFrameFilter &) = delete;
 
    bool CheckFilters(unsigned int slot, int entry)
    {
       if (entry != fLastCheckedEntry[slot]) {
-         if (!fPrevData->CheckFilters(slot, entry)) {
+         if (fReorder && fChain.size() > 1) {
+            fLastResult[slot] = CheckReorderedFilters(slot, entry);
+         } else if (!fPrevData->CheckFilters(slot, entry)) {
             // a filter upstream returned false, cache the result
             fLastResult[slot] = false;
          } else {
             // evaluate this filter, cache the result
-            fLastResult[slot] = CheckFilterHelper(BranchTypes_t(), TypeInd_t(), slot, entry);
+            if (fReorder)
+               fLastResult[slot] = CheckOwnFilter(slot, entry, false); // it might be in the chain of another filter
+            else
+               fLastResult[slot] = EvaluateFilter(slot, entry);
          }
          fLastCheckedEntry[slot] = entry;
       }
       return fLastResult[slot];
    }
 
+   // Evaluate the filters of the chain in the order of this slot. The first
+   // entries are sampled: all filters are evaluated and timed, then the chain is
+   // sorted by increasing rank, which minimizes the expected cost per entry for
+   // filters with independent outcomes.
+   bool CheckReorderedFilters(unsigned int slot, int entry)
+   {
+      auto &order = fOrder[slot];
+      if (fNSampled[slot] < fgNSampledEntries) {
+         bool pass = true;
+         for (auto filter : order) pass = filter->CheckOwnFilter(slot, entry, true) && pass;
+         if (++fNSampled[slot] == fgNSampledEntries) {
+            std::stable_sort(order.begin(), order.end(), [slot](TDataFrameFilterBase *a, TDataFrameFilterBase *b) {
+               return a->GetRank(slot) < b->GetRank(slot);
+            });
+         }
+         return pass;
+      }
+      for (auto filter : order)
+         if (!filter->CheckOwnFilter(slot, entry, false)) return false;
+      return true;
+   }
+
+   bool CheckOwnFilter(unsigned int slot, int entry, bool measure)
+   {
+      if (entry != fLastOwnCheckedEntry[slot]) {
+         if (measure) {
+            auto &sample = fSampleStats[slot];
+            const auto start = std::chrono::steady_clock::now();
+            fLastOwnResult[slot] = EvaluateFilter(slot, entry);
+            sample.fTime += std::chrono::steady_clock::now() - start;
+            ++sample.fAll;
+            if (fLastOwnResult[slot]) ++sample.fPass;
+         } else {
+            fLastOwnResult[slot] = EvaluateFilter(slot, entry);
+         }
+         fLastOwnCheckedEntry[slot] = entry;
+      }
+      return fLastOwnResult[slot];
+   }
+
+   // computed from the sampled entries only: the other evaluations of the filter
+   // only see the entries accepted by the filters before it
+   double GetRank(unsigned int slot) const
+   {
+      const auto &stats = fSampleStats[slot];
+      if (stats.fAll == 0) return 0.;
+      const double cost = std::chrono::duration<double>(stats.fTime).count() / stats.fAll;
+      const double failRate = double(stats.fAll - stats.fPass) / stats.fAll;
+      return failRate > 0. ? cost / failRate : std::numeric_limits<double>::infinity();
+   }
+
    template <int... S, typename... BranchTypes>
    bool CheckFilterHelper(Internal::TDFTraitsUtils::TTypeList<BranchTypes...>,
                           Internal::TDFTraitsUtils::TStaticSeq<S...>,
@@ -1326,8 +5132,47 @@ public:
    void CreateSlots(unsigned int nSlots)
    {
       fReaderValues.resize(nSlots);
-      fLastCheckedEntry.resize(nSlots);
+      fLastCheckedEntry.assign(nSlots, -1);
       fLastResult.resize(nSlots);
+      auto df = fPrevData->GetDataFrame().lock();
+      fReorder = df->GetFilterReordering();
+      fProfilers = df->GetSlotProfilers();
+      fStats.resize(nSlots);
+      if (fReorder) {
+         fOrder.assign(nSlots, fChain);
+         fNSampled.assign(nSlots, 0);
+         fSampleStats.assign(nSlots, Internal::TNodeSlotStats());
+         fLastOwnCheckedEntry.assign(nSlots, -1);
+         fLastOwnResult.resize(nSlots);
+      }
+   }
+
+   void FillReport(TCutFlowReport &rep) const
+   {
+      if (fName.empty()) return;
+      ULong64_t all = 0, pass = 0;
+      std::chrono::steady_clock::duration time(0);
+      for (auto &stats : fStats) {
+         all += stats.fAll;
+         pass += stats.fPass;
+         time += stats.fTime;
+      }
+      rep.AddCut(TCutInfo(fName, all, pass, std::chrono::duration<double>(time).count()));
+   }
+
+   Internal::TGraphNode GetGraphNode() const
+   {
+      Internal::TGraphNode node("Filter", fName.empty() ? "Filter(" + Internal::JoinBranchNames(fBranches) + ")" : fName,
+                                fGraphId, fPrevData->GetGraphId());
+      node.AddStats(fStats, !fName.empty() || fProfilers);
+      return node;
+   }
+
+private:
+   static FilterChain_t AppendToChain(FilterChain_t chain, TDataFrameFilterBase *filter)
+   {
+      chain.emplace_back(filter);
+      return chain;
    }
 };
 
@@ -1341,10 +5186,36 @@ class TDataFrameImpl {
    TDirectory *fDirPtr = nullptr;
    TTree *fTree = nullptr;
    const BranchVec fDefaultBranches;
-   // always empty: each object in the chain copies this list from the previous
-   // and they must copy an empty list from the base TDataFrameImpl
-   const BranchVec fTmpBranches;
+   // only contains "tdfentry_": each object in the chain copies this list from
+   // the previous and appends its own temporary branch, if any
+   const BranchVec fTmpBranches = {"tdfentry_"};
    unsigned int fNSlots;
+   // this sets a total size of 16 MB for the buffers of histograms without axis limits
+   unsigned int fHistoBufSize = 2097152;
+   // above 256 MB of per-slot copies of their bins, histograms are filled through a single copy
+   ULong64_t fHistoMemThreshold = 268435456;
+   // memory for the partial results of actions that can spill them to disk, 0 for no limit
+   ULong64_t fActionMemoryBudget = 0;
+   // whether filters are evaluated in the order that minimizes their expected cost
+   bool fFilterReordering = false;
+   // whether all nodes are timed, see TDataFrameInterface::SetProfiling
+   bool fProfiling = false;
+   std::vector<Internal::TSlotProfiler> fSlotProfilers;
+   // whether the events of the event loop are recorded, see TDataFrameInterface::SetTracing.
+   // Those of the last run, one vector per slot and a last one for merging.
+   bool fTracing = false;
+   std::vector<std::vector<Internal::TTraceEvent>> fTraceEvents;
+   std::chrono::steady_clock::time_point fTraceStart;
+   // what the slots read during the current run, and the statistics of the last run
+   std::vector<ULong64_t> fRunSlotEntries;
+   std::vector<ULong64_t> fRunSlotBytesRead;
+   TRunStats fRunStats;
+   // entries read by each slot, summed over all runs, and time spent in TTreeReader::Next when profiling
+   std::vector<Internal::TNodeSlotStats> fStats;
+   // the actions of the last run, which are forgotten once it is over
+   std::vector<Internal::TGraphNode> fRunActionNodes;
+   // the last id given to a node of the graph, 1 being the TDataFrame itself
+   unsigned int fLastGraphId = 1;
    // TDataFrameInterface<TDataFrameImpl> calls SetFirstData to set this to a
    // weak pointer to the TDataFrameImpl object itself
    // so subsequent objects in the chain can call GetDataFrame on TDataFrameImpl
@@ -1352,15 +5223,23 @@ class TDataFrameImpl {
 
 public:
    TDataFrameImpl(const std::string &treeName, TDirectory *dirPtr, const BranchVec &defaultBranches = {})
-      : fTreeName(treeName), fDirPtr(dirPtr), fDefaultBranches(defaultBranches), fNSlots(ROOT::Internal::GetNSlots()) { }
+      : fTreeName(treeName), fDirPtr(dirPtr), fDefaultBranches(defaultBranches), fNSlots(ROOT::Internal::GetNSlots())
+   {
+      Book(std::make_shared<TDataFrameEntryBranch>());
+   }
 
    TDataFrameImpl(TTree &tree, const BranchVec &defaultBranches = {}) : fTree(&tree), fDefaultBranches(defaultBranches), fNSlots(ROOT::Internal::GetNSlots())
-   { }
+   {
+      Book(std::make_shared<TDataFrameEntryBranch>());
+   }
 
    TDataFrameImpl(const TDataFrameImpl &) = delete;
 
    void Run()
    {
+      const auto start = std::chrono::steady_clock::now();
+      const auto cpuStart = std::clock();
+      fTraceStart = start;
 #ifdef R__USE_IMT
       if (ROOT::IsImplicitMTEnabled()) {
          const auto fileName = fTree ? static_cast<TFile *>(fTree->GetCurrentFile())->GetName() : fDirPtr->GetName();
@@ -1385,12 +5264,7 @@ public:
                }
             }
 
-            BuildAllReaderValues(r, slot);
-
-            // recursive call to check filters and conditionally execute actions
-            while (r.Next())
-               for (auto &actionPtr : fBookedActions)
-                  actionPtr->Run(slot, r.GetCurrentEntry());
+            RunTask(r, slot);
          });
       } else {
 #endif // R__USE_IMT
@@ -1402,22 +5276,82 @@ public:
          }
 
          CreateSlots(1);
-         BuildAllReaderValues(r, 0);
-
-         // recursive call to check filters and conditionally execute actions
-         while (r.Next())
-            for (auto &actionPtr : fBookedActions)
-               actionPtr->Run(0, r.GetCurrentEntry());
+         RunTask(r, 0);
 #ifdef R__USE_IMT
       }
 #endif // R__USE_IMT
 
-      // forget actions and "detach" the action result pointers marking them ready and forget them too
+      // forget actions and "detach" the action result pointers marking them ready and forget them too.
+      // Destroying the actions merges their per-slot results.
+      fRunActionNodes.clear();
+      for (auto &ptr : fBookedActions) fRunActionNodes.emplace_back(ptr->GetGraphNode());
+      const auto mergeStart = std::chrono::steady_clock::now();
       fBookedActions.clear();
+      if (fTracing) fTraceEvents.back().emplace_back("Merge", mergeStart, std::chrono::steady_clock::now());
       for (auto readiness : fResPtrsReadiness) {
          *readiness.get() = true;
       }
       fResPtrsReadiness.clear();
+
+      FillRunStats(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                   double(std::clock() - cpuStart) / CLOCKS_PER_SEC);
+   }
+
+   void FillRunStats(double wallTime, double cpuTime)
+   {
+      ULong64_t bytesRead = 0;
+      for (auto slotBytesRead : fRunSlotBytesRead) bytesRead += slotBytesRead;
+      auto uncompressedBytes = bytesRead;
+      auto tree = GetTree();
+      if (tree && tree->GetZipBytes() > 0)
+         uncompressedBytes = ULong64_t(double(bytesRead) * tree->GetTotBytes() / tree->GetZipBytes());
+      fRunStats = TRunStats(fRunSlotEntries, bytesRead, uncompressedBytes, wallTime, cpuTime);
+   }
+
+   // the compressed bytes read so far from the file of the reader
+   static Long64_t GetBytesRead(TTreeReader &r)
+   {
+      auto file = r.GetTree() ? r.GetTree()->GetCurrentFile() : nullptr;
+      return file ? file->GetBytesRead() : 0;
+   }
+
+   // build the reader values of a slot and loop over the entries of its reader
+   void RunTask(TTreeReader &r, unsigned int slot)
+   {
+      const auto start = std::chrono::steady_clock::now();
+      const auto bytesBefore = GetBytesRead(r);
+      BuildAllReaderValues(r, slot);
+      const auto loopStart = std::chrono::steady_clock::now();
+      const auto entriesBefore = fStats[slot].fAll;
+      Long64_t firstEntry = -1;
+
+      // recursive call to check filters and conditionally execute actions
+      while (NextEntry(r, slot)) {
+         if (firstEntry < 0) firstEntry = r.GetCurrentEntry();
+         for (auto &actionPtr : fBookedActions)
+            actionPtr->Run(slot, r.GetCurrentEntry());
+      }
+
+      const auto nEntries = fStats[slot].fAll - entriesBefore;
+      fRunSlotEntries[slot] += nEntries;
+      fRunSlotBytesRead[slot] += GetBytesRead(r) - bytesBefore;
+
+      if (!fTracing) return;
+      const auto end = std::chrono::steady_clock::now();
+      auto &events = fTraceEvents[slot];
+      events.emplace_back("Task", start, end, firstEntry, nEntries);
+      events.emplace_back("BuildAllReaderValues", start, loopStart);
+      events.emplace_back("Entry loop", loopStart, end);
+   }
+
+   // move the reader of a slot to its next entry, if any, and count it
+   bool NextEntry(TTreeReader &r, unsigned int slot)
+   {
+      auto &stats = fStats[slot];
+      const Internal::TProfiledRegion region(fProfiling ? &fSlotProfilers[slot] : nullptr, stats.fTime);
+      if (!r.Next()) return false;
+      ++stats.fAll;
+      return true;
    }
 
    // build reader values for all actions, filters and branches
@@ -1431,6 +5365,11 @@ public:
    // inform all actions filters and branches of the required number of slots
    void CreateSlots(unsigned int nSlots)
    {
+      fStats.resize(nSlots);
+      fSlotProfilers.resize(nSlots);
+      fTraceEvents.assign(nSlots + 1, {});
+      fRunSlotEntries.assign(nSlots, 0);
+      fRunSlotBytesRead.assign(nSlots, 0);
       for (auto &ptr : fBookedActions) ptr->CreateSlots(nSlots);
       for (auto &ptr : fBookedFilters) ptr->CreateSlots(nSlots);
       for (auto &bookedBranch : fBookedBranches) bookedBranch.second->CreateSlots(nSlots);
@@ -1442,6 +5381,15 @@ public:
 
    const BranchVec GetTmpBranches() const { return fTmpBranches; }
 
+   // end of the chain of filters, see TDataFrameFilter::GetFilterChain
+   FilterChain_t GetFilterChain() const { return {}; }
+
+   unsigned int GetGraphId() const { return 1; }
+
+   // a new id for a node of the graph: unlike its address, it is never reused
+   // by the nodes booked after it is destroyed
+   unsigned int NewGraphId() { return ++fLastGraphId; }
+
    TTree* GetTree() const {
       if (fTree) {
          return fTree;
@@ -1456,6 +5404,12 @@ public:
       return *fBookedBranches.find(name)->second.get();
    }
 
+   const std::map<std::string, TmpBranchBasePtr_t> &GetBookedBranches() const { return fBookedBranches; }
+
+   const Details::FilterBaseVec_t &GetBookedFilters() const { return fBookedFilters; }
+
+   const Internal::ActionBaseVec_t &GetBookedActions() const { return fBookedActions; }
+
    void *GetTmpBranchValue(const std::string &branch, unsigned int slot, int entry)
    {
       return fBookedBranches.at(branch)->GetValue(slot, entry);
@@ -1476,8 +5430,60 @@ public:
    // dummy call, end of recursive chain of calls
    bool CheckFilters(int, unsigned int) { return true; }
 
+   // the statistics of the named filters, in booking order
+   void FillReport(TCutFlowReport &rep) const
+   {
+      for (auto &ptr : fBookedFilters) ptr->FillReport(rep);
+   }
+
+   // the nodes of the graph, from the TDataFrame itself downstream: the actions
+   // are those of the last run, followed by those booked since
+   std::vector<Internal::TGraphNode> GetGraphNodes() const
+   {
+      std::vector<Internal::TGraphNode> nodes;
+      nodes.emplace_back("TDataFrame", fTree ? fTree->GetName() : fTreeName, GetGraphId(), 0);
+      nodes.back().AddStats(fStats, fProfiling);
+      for (auto &ptr : fBookedFilters) nodes.emplace_back(ptr->GetGraphNode());
+      for (auto &bookedBranch : fBookedBranches)
+         if (bookedBranch.first != "tdfentry_") nodes.emplace_back(bookedBranch.second->GetGraphNode());
+      nodes.insert(nodes.end(), fRunActionNodes.begin(), fRunActionNodes.end());
+      for (auto &ptr : fBookedActions) nodes.emplace_back(ptr->GetGraphNode());
+      return nodes;
+   }
+
    unsigned int GetNSlots() {return fNSlots;}
 
+   unsigned int GetHistoBufferSize() const { return fHistoBufSize; }
+
+   void SetHistoBufferSize(unsigned int bufSize) { fHistoBufSize = bufSize; }
+
+   ULong64_t GetHistoMemoryThreshold() const { return fHistoMemThreshold; }
+
+   void SetHistoMemoryThreshold(ULong64_t bytes) { fHistoMemThreshold = bytes; }
+
+   ULong64_t GetActionMemoryBudget() const { return fActionMemoryBudget; }
+
+   void SetActionMemoryBudget(ULong64_t bytes) { fActionMemoryBudget = bytes; }
+
+   bool GetFilterReordering() const { return fFilterReordering; }
+
+   void SetFilterReordering(bool reorder) { fFilterReordering = reorder; }
+
+   bool GetProfiling() const { return fProfiling; }
+
+   void SetProfiling(bool profile) { fProfiling = profile; }
+
+   bool GetTracing() const { return fTracing; }
+
+   void SetTracing(bool trace) { fTracing = trace; }
+
+   std::string GetTrace() const { return Internal::TraceToJson(fTraceEvents, fTraceStart); }
+
+   const TRunStats &GetRunStats() const { return fRunStats; }
+
+   // the profilers of the processing slots, null unless profiling
+   Internal::TSlotProfiler *GetSlotProfilers() { return fProfiling ? fSlotProfilers.data() : nullptr; }
+
    template<typename T>
    TActionResultProxy<T> MakeActionResultPtr(std::shared_ptr<T> r)
    {
@@ -1522,6 +5528,14 @@ void TActionResultProxy<T>::TriggerRun()
 }
 
 namespace Internal {
+namespace Operations {
+ReportOperation::~ReportOperation()
+{
+   auto df = fDataFrame.lock();
+   if (df) df->FillReport(*fReport);
+}
+} // end NS Operations
+
 template <int S, typename T>
 T &GetBranchValue(TVBPtr_t &readerValue, unsigned int slot, int entry, const std::string &branch,
                   std::weak_ptr<Details::TDataFrameImpl> df)
@@ -0,0 +1,315 @@
+// A suite of micro-benchmarks of TDataFrame. Each scenario books a graph on a
+// generated tree and runs the event loop: scenarios are parameterized by the
+// depth of the chain of filters, the number of actions, the number of
+// temporary branches and the kind of branch, and each built-in action has its own.
+// Every scenario is run a number of times after some warm-up runs, and the
+// distribution of the times is summarized, on screen and optionally in JSON.
+//
+// Usage: suite [-n entries] [-r repetitions] [-w warm-up runs] [-t threads] [-s selection] [-o output.json]
+// -t enables implicit multi-threading with that many threads. -s only runs the
+// scenarios whose name contains the selection. -o writes the summaries in JSON,
+// to standard output for "-".
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include "../TDataFrame.hxx"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TH2F.h"
+#include "TH3F.h"
+#include "TProfile.h"
+#include "TProfile2D.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+const char *treeName = "suiteTree";
+
+struct TConfig {
+   ULong64_t fEntries = 1000000;
+   unsigned int fReps = 10;
+   unsigned int fWarmup = 2;
+   unsigned int fThreads = 0; // 0 for no implicit multi-threading
+   std::string fSelection;
+   std::string fOutput;
+};
+
+struct TScenario {
+   std::string fName;
+   std::function<void(ROOT::TDataFrame &)> fRun; // books the actions and runs the event loop
+};
+
+struct TSummary {
+   std::string fName;
+   std::vector<double> fTimes; // in seconds, one per repetition
+   double fMin, fMedian, fMean, fStdDev, fMax;
+};
+
+// A tree with scalar branches of both types, a key and a collection
+void FillTree(const std::string &fileName, ULong64_t entries)
+{
+   if (!gSystem->AccessPathName(fileName.c_str())) return;
+   TFile f(fileName.c_str(), "RECREATE");
+   TTree t(treeName, treeName);
+   double x, y, w;
+   int i, k;
+   std::vector<double> v;
+   t.Branch("x", &x);
+   t.Branch("y", &y);
+   t.Branch("w", &w);
+   t.Branch("i", &i);
+   t.Branch("k", &k);
+   t.Branch("v", &v);
+   std::mt19937_64 gen(1);
+   std::normal_distribution<double> gaus(0., 1.);
+   std::uniform_real_distribution<double> uniform(0., 1.);
+   for (ULong64_t entry = 0; entry < entries; ++entry) {
+      x = gaus(gen);
+      y = x + gaus(gen);
+      w = uniform(gen);
+      i = int(entry);
+      k = int(entry % 100);
+      v.assign(4, x);
+      for (auto &e : v) e += gaus(gen);
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+// A cut passed by all entries. The threshold makes each filter of a chain a different node.
+struct TPassCut {
+   double fMin;
+   bool operator()(double x) const { return x > fMin; }
+};
+
+// A chain of N filters, then a Count
+template <int N>
+struct TFilterChain {
+   template <typename Node>
+   static ROOT::TActionResultProxy<unsigned int> Count(Node node)
+   {
+      return TFilterChain<N - 1>::Count(node.Filter(TPassCut{-1000. - N}, {"x"}));
+   }
+};
+
+template <>
+struct TFilterChain<0> {
+   template <typename Node>
+   static ROOT::TActionResultProxy<unsigned int> Count(Node node)
+   {
+      return node.Count();
+   }
+};
+
+// A chain of N temporary branches, each computed from the previous one, then a Sum of the last one
+template <int N>
+struct TBranchChain {
+   template <typename Node>
+   static ROOT::TActionResultProxy<double> Sum(Node node, const std::string &prevName)
+   {
+      const auto name = "b" + std::to_string(N);
+      return TBranchChain<N - 1>::Sum(node.AddBranch(name, [](double b) { return b + 1.; }, {prevName}), name);
+   }
+};
+
+template <>
+struct TBranchChain<0> {
+   template <typename Node>
+   static ROOT::TActionResultProxy<double> Sum(Node node, const std::string &prevName)
+   {
+      return node.Sum(prevName);
+   }
+};
+
+// N actions which cannot be fused, one histogram each
+void RunHistos(ROOT::TDataFrame &d, unsigned int n)
+{
+   std::vector<ROOT::TActionResultProxy<TH1F>> histos;
+   for (unsigned int i = 0; i < n; ++i)
+      histos.emplace_back(d.Fill<double>(TH1F(("h" + std::to_string(i)).c_str(), "h", 100, -5, 5), {"x"}));
+   *histos.front();
+}
+
+// N actions on the same branch, fused into one node
+void RunSums(ROOT::TDataFrame &d, unsigned int n)
+{
+   std::vector<ROOT::TActionResultProxy<double>> sums;
+   for (unsigned int i = 0; i < n; ++i) sums.emplace_back(d.Sum("x"));
+   *sums.front();
+}
+
+std::vector<TScenario> MakeScenarios()
+{
+   const TH1F model("h", "h", 100, -5, 5);
+   std::vector<TScenario> s;
+   // structure of the graph
+   s.push_back({"filters/1", [](ROOT::TDataFrame &d) { *TFilterChain<1>::Count(d); }});
+   s.push_back({"filters/2", [](ROOT::TDataFrame &d) { *TFilterChain<2>::Count(d); }});
+   s.push_back({"filters/4", [](ROOT::TDataFrame &d) { *TFilterChain<4>::Count(d); }});
+   s.push_back({"filters/8", [](ROOT::TDataFrame &d) { *TFilterChain<8>::Count(d); }});
+   s.push_back({"filters/16", [](ROOT::TDataFrame &d) { *TFilterChain<16>::Count(d); }});
+   s.push_back({"branches/1", [](ROOT::TDataFrame &d) { *TBranchChain<1>::Sum(d, "x"); }});
+   s.push_back({"branches/2", [](ROOT::TDataFrame &d) { *TBranchChain<2>::Sum(d, "x"); }});
+   s.push_back({"branches/4", [](ROOT::TDataFrame &d) { *TBranchChain<4>::Sum(d, "x"); }});
+   s.push_back({"branches/8", [](ROOT::TDataFrame &d) { *TBranchChain<8>::Sum(d, "x"); }});
+   s.push_back({"branches/16", [](ROOT::TDataFrame &d) { *TBranchChain<16>::Sum(d, "x"); }});
+   for (unsigned int n : {1, 2, 4, 8, 16}) {
+      s.push_back({"actions/" + std::to_string(n), [n](ROOT::TDataFrame &d) { RunHistos(d, n); }});
+      s.push_back({"fused_actions/" + std::to_string(n), [n](ROOT::TDataFrame &d) { RunSums(d, n); }});
+   }
+   // kind of branch
+   s.push_back({"columns/scalar", [model](ROOT::TDataFrame &d) { *d.Histo("x", model); }});
+   s.push_back({"columns/collection", [model](ROOT::TDataFrame &d) { *d.Histo<std::vector<double>>("v", model); }});
+   // built-in actions
+   s.push_back({"action/Count", [](ROOT::TDataFrame &d) { *d.Count(); }});
+   s.push_back({"action/Min", [](ROOT::TDataFrame &d) { *d.Min("x"); }});
+   s.push_back({"action/Max", [](ROOT::TDataFrame &d) { *d.Max("x"); }});
+   s.push_back({"action/Mean", [](ROOT::TDataFrame &d) { *d.Mean("x"); }});
+   s.push_back({"action/Sum", [](ROOT::TDataFrame &d) { *d.Sum("x"); }});
+   s.push_back({"action/Variance", [](ROOT::TDataFrame &d) { *d.Variance("x"); }});
+   s.push_back({"action/StdDev", [](ROOT::TDataFrame &d) { *d.StdDev("x"); }});
+   s.push_back({"action/Stats", [](ROOT::TDataFrame &d) { *d.Stats("x"); }});
+   s.push_back({"action/Covariance", [](ROOT::TDataFrame &d) { *d.Covariance({"x", "y"}); }});
+   s.push_back({"action/Quantiles", [](ROOT::TDataFrame &d) { *d.Quantiles("x", {0.1, 0.5, 0.9}); }});
+   s.push_back({"action/CountDistinct", [](ROOT::TDataFrame &d) { *d.CountDistinct<int>("i"); }});
+   s.push_back({"action/CountDistinct_hll", [](ROOT::TDataFrame &d) { *d.CountDistinct<int>("i", 14); }});
+   s.push_back({"action/Take", [](ROOT::TDataFrame &d) { *d.Take<double>("x"); }});
+   s.push_back({"action/TakeOrdered", [](ROOT::TDataFrame &d) { *d.TakeOrdered<double>("x"); }});
+   s.push_back({"action/TakeFlat", [](ROOT::TDataFrame &d) { *d.TakeFlat<double>("v"); }});
+   s.push_back({"action/TakeSorted", [](ROOT::TDataFrame &d) { *d.TakeSorted<double>("x"); }});
+   s.push_back({"action/TopK", [](ROOT::TDataFrame &d) { *d.TopK<double>("x", 10); }});
+   s.push_back({"action/Histo", [model](ROOT::TDataFrame &d) { *d.Histo("x", model); }});
+   s.push_back({"action/Histo_auto", [](ROOT::TDataFrame &d) { *d.Histo("x"); }});
+   s.push_back({"action/Histo_weighted", [model](ROOT::TDataFrame &d) { *d.Histo("x", "w", model); }});
+   s.push_back({"action/Histo2D",
+                [](ROOT::TDataFrame &d) { *d.Histo2D(TH2F("h2", "h2", 100, -5, 5, 100, -5, 5), "x", "y"); }});
+   s.push_back({"action/Histo3D", [](ROOT::TDataFrame &d) {
+                   *d.Histo3D(TH3F("h3", "h3", 20, -5, 5, 20, -5, 5, 20, 0, 1), "x", "y", "w");
+                }});
+   s.push_back({"action/Profile1D",
+                [](ROOT::TDataFrame &d) { *d.Profile1D(TProfile("p1", "p1", 100, -5, 5), "x", "y"); }});
+   s.push_back({"action/Profile2D", [](ROOT::TDataFrame &d) {
+                   *d.Profile2D(TProfile2D("p2", "p2", 20, -5, 5, 20, -5, 5), "x", "y", "w");
+                }});
+   s.push_back({"action/Fill", [model](ROOT::TDataFrame &d) { *d.Fill<double>(model, {"x"}); }});
+   s.push_back({"action/Foreach", [](ROOT::TDataFrame &d) {
+                   std::vector<double> sums(ROOT::Internal::GetNSlots());
+                   d.ForeachSlot([&sums](unsigned int slot, double x) { sums[slot] += x; }, {"x"});
+                }});
+   s.push_back({"action/Report", [](ROOT::TDataFrame &d) {
+                   auto positive = d.Filter(TPassCut{0.}, {"x"}, "positive");
+                   auto count = positive.Count(); // the filter is only evaluated for an action downstream
+                   *positive.Report();
+                }});
+   s.push_back({"action/GroupBy_Count", [](ROOT::TDataFrame &d) { *d.GroupBy<int>("k").Count(); }});
+   s.push_back({"action/GroupBy_Histo", [model](ROOT::TDataFrame &d) { *d.GroupBy<int>("k").Histo("x", model); }});
+   return s;
+}
+
+double TimeRun(const TScenario &scenario, TFile &f)
+{
+   ROOT::TDataFrame d(treeName, &f);
+   const auto start = std::chrono::steady_clock::now();
+   scenario.fRun(d);
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+TSummary Summarize(const std::string &name, std::vector<double> times)
+{
+   TSummary summary;
+   summary.fName = name;
+   summary.fTimes = times;
+   std::sort(times.begin(), times.end());
+   const auto n = times.size();
+   summary.fMin = times.front();
+   summary.fMax = times.back();
+   summary.fMedian = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+   double sum = 0, sum2 = 0;
+   for (auto t : times) sum += t;
+   summary.fMean = sum / n;
+   for (auto t : times) sum2 += (t - summary.fMean) * (t - summary.fMean);
+   summary.fStdDev = n > 1 ? std::sqrt(sum2 / (n - 1)) : 0.;
+   return summary;
+}
+
+void WriteJson(const std::vector<TSummary> &summaries, const TConfig &config)
+{
+   auto out = config.fOutput == "-" ? stdout : std::fopen(config.fOutput.c_str(), "w");
+   if (!out) {
+      std::fprintf(stderr, "Cannot open %s\n", config.fOutput.c_str());
+      std::exit(1);
+   }
+   std::fprintf(out, "{\"config\": {\"entries\": %llu, \"repetitions\": %u, \"warmup\": %u, \"threads\": %u},\n",
+                (unsigned long long)config.fEntries, config.fReps, config.fWarmup, config.fThreads);
+   std::fprintf(out, " \"results\": [");
+   for (std::size_t i = 0; i < summaries.size(); ++i) {
+      auto &s = summaries[i];
+      std::fprintf(out,
+                   "%s\n  {\"name\": \"%s\", \"min\": %.6g, \"median\": %.6g, \"mean\": %.6g, \"stddev\": %.6g, "
+                   "\"max\": %.6g, \"entries_per_second\": %.6g, \"times\": [",
+                   i ? "," : "", s.fName.c_str(), s.fMin, s.fMedian, s.fMean, s.fStdDev, s.fMax,
+                   config.fEntries / s.fMedian);
+      for (std::size_t r = 0; r < s.fTimes.size(); ++r) std::fprintf(out, "%s%.6g", r ? ", " : "", s.fTimes[r]);
+      std::fprintf(out, "]}");
+   }
+   std::fprintf(out, "\n]}\n");
+   if (out != stdout) std::fclose(out);
+}
+
+TConfig ParseArgs(int argc, char **argv)
+{
+   TConfig config;
+   for (int i = 1; i < argc; ++i) {
+      if (i + 1 == argc || argv[i][0] != '-' || std::strlen(argv[i]) != 2) {
+         std::fprintf(stderr, "Usage: %s [-n entries] [-r repetitions] [-w warm-up runs] [-t threads] "
+                              "[-s selection] [-o output.json]\n", argv[0]);
+         std::exit(1);
+      }
+      const std::string value = argv[++i];
+      switch (argv[i - 1][1]) {
+      case 'n': config.fEntries = std::stoull(value); break;
+      case 'r': config.fReps = std::max(1, std::stoi(value)); break;
+      case 'w': config.fWarmup = std::stoi(value); break;
+      case 't': config.fThreads = std::stoi(value); break;
+      case 's': config.fSelection = value; break;
+      case 'o': config.fOutput = value; break;
+      default: std::fprintf(stderr, "Unknown option %s\n", argv[i - 1]); std::exit(1);
+      }
+   }
+   return config;
+}
+
+int main(int argc, char **argv)
+{
+   const auto config = ParseArgs(argc, argv);
+   const auto fileName = "suiteTree_" + std::to_string(config.fEntries) + ".root";
+   FillTree(fileName, config.fEntries);
+   TFile f(fileName.c_str());
+   if (config.fThreads) ROOT::EnableImplicitMT(config.fThreads);
+
+   // the table goes to stderr if the JSON goes to stdout
+   auto table = config.fOutput == "-" ? stderr : stdout;
+   std::fprintf(table, "%-28s %10s %10s %10s %10s %10s %12s\n", "scenario", "min [s]", "median [s]", "mean [s]",
+                "stddev [s]", "max [s]", "entries/s");
+   std::vector<TSummary> summaries;
+   for (auto &scenario : MakeScenarios()) {
+      if (scenario.fName.find(config.fSelection) == std::string::npos) continue;
+      for (unsigned int i = 0; i < config.fWarmup; ++i) TimeRun(scenario, f);
+      std::vector<double> times;
+      for (unsigned int i = 0; i < config.fReps; ++i) times.emplace_back(TimeRun(scenario, f));
+      summaries.emplace_back(Summarize(scenario.fName, times));
+      auto &s = summaries.back();
+      std::fprintf(table, "%-28s %10.4f %10.4f %10.4f %10.4f %10.4f %12.4g\n", s.fName.c_str(), s.fMin, s.fMedian,
+                   s.fMean, s.fStdDev, s.fMax, config.fEntries / s.fMedian);
+   }
+   if (!config.fOutput.empty()) WriteJson(summaries, config);
+   return 0;
+}
@@ -23,6 +23,11 @@ int main() {
    } catch (const std::runtime_error& e) {
       std::cout << "Exception catched: " << e.what() << std::endl;
    }
+   try {
+      auto g = d.AddBranch("tdfentry_", []() { return 42; });
+   } catch (const std::runtime_error& e) {
+      std::cout << "Exception catched: " << e.what() << std::endl;
+   }
    
    return 0;
 }
@@ -0,0 +1,240 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+#include "TH1F.h"
+
+#include "TDataFrame.hxx"
+
+#include <atomic>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+void FillTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   t.SetAutoFlush(1000);
+   int i;
+   t.Branch("i", &i);
+   for (i = 0; i < 10000; ++i)
+      t.Fill();
+   t.Write();
+   f.Close();
+}
+
+std::atomic<int> gNSquares(0);
+std::atomic<int> gNCuts(0);
+
+int Square(int i)
+{
+   ++gNSquares;
+   return i * i;
+}
+
+struct TCut {
+   int fThreshold;
+   bool operator()(int i) const
+   {
+      ++gNCuts;
+      return i < fThreshold;
+   }
+};
+
+void CheckSharedNodes(TFile &f)
+{
+   gNSquares = 0;
+   gNCuts = 0;
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   TCut cut{5000};
+   // same filter on the same node, twice: one node
+   auto c1 = d.Filter(cut).Count();
+   auto c2 = d.Filter(cut).Count();
+   // same expression under another name, and downstream of another node: evaluated once
+   auto s1 = d.AddBranch("sq", Square).Take<int>("sq");
+   auto s2 = d.Filter(cut).AddBranch("sq2", Square).Take<int>("sq2");
+   // different capture: a different filter
+   auto c3 = d.Filter(TCut{100}).Count();
+
+   assert(*c1 == 5000 && *c2 == 5000 && *c3 == 100);
+   assert(s1->size() == 10000 && s2->size() == 5000);
+   assert(gNSquares == 10000);
+   assert(gNCuts == 20000);
+}
+
+// the state of a mutable callable changes with each call: nodes booked with copies of the
+// same callable each compute their own values. Checked sequentially only, since the
+// state of a node is not protected against concurrent calls.
+struct TCounter {
+   int fN;
+   int operator()(int) { return fN++; }
+};
+
+void CheckMutableCallables(TFile &f)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   int n = 0;
+   auto counter = [n](int) mutable { return n++; };
+   auto even = d.Filter([](int i) { return i % 2 == 0; });
+   auto first = d.Filter(TCut{100});
+   auto evenCounts = even.AddBranch("n1", counter).Take<int>("n1");
+   auto firstCounts = first.AddBranch("n2", counter).Take<int>("n2");
+   auto evenFunctorCounts = even.AddBranch("m1", TCounter{0}).Take<int>("m1");
+   auto firstFunctorCounts = first.AddBranch("m2", TCounter{0}).Take<int>("m2");
+
+   assert(evenCounts->size() == 5000 && firstCounts->size() == 100);
+   for (int k = 0; k < 5000; ++k) assert((*evenCounts)[k] == k && (*evenFunctorCounts)[k] == k);
+   for (int k = 0; k < 100; ++k) assert((*firstCounts)[k] == k && (*firstFunctorCounts)[k] == k);
+}
+
+void CheckFusedActions(TFile &f)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   auto withX = d.AddBranch("x", [](int i) { return i * 1.; });
+   auto filtered = withX.Filter([](int i) { return i % 2 == 0; });
+   // actions on the same branch of the same node are fused, whatever their type
+   auto min = withX.Min("x");
+   auto max = withX.Max("x");
+   auto mean = withX.Mean("x");
+   auto h = withX.Histo("x", TH1F("h", "h", 10, 0, 10000));
+   auto values = withX.Take<double>("x");
+   auto ints = withX.Take<int>();
+   auto filteredMax = filtered.Max("x");
+   auto filteredValues = filtered.Take<double>("x");
+
+   assert(*min == 0 && *max == 9999 && *mean == 4999.5);
+   assert(h->GetEntries() == 10000 && h->GetBinContent(1) == 1000);
+   assert(values->size() == 10000 && ints->size() == 10000);
+   assert(*filteredMax == 9998 && filteredValues->size() == 5000);
+
+   // actions booked after an event loop run in the next one
+   auto min2 = filtered.Min("x");
+   auto sum2 = filtered.Sum("x");
+   assert(*min2 == 0 && *sum2 == 24995000);
+}
+
+bool Contains(const std::string &s, const std::string &sub) { return s.find(sub) != std::string::npos; }
+
+void CheckGraph(TFile &f)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   auto even = d.Filter([](int i) { return i % 2 == 0; });
+   auto small = even.Filter([](int i) { return i < 1000; }, "small");
+   auto c = small.AddBranch("half", [](int i) { return i / 2; }).Take<int>("half");
+
+   // before the event loop, nothing has been processed yet
+   auto dot = d.GetGraph();
+   assert(Contains(dot, "digraph") && Contains(dot, "label=\"Action(half)\\nentries: 0\""));
+   assert(c->size() == 500);
+
+   dot = d.GetGraph();
+   assert(Contains(dot, "label=\"graphTree\\nentries: 10000\""));
+   assert(Contains(dot, "label=\"Filter(i)\\nentries: 10000\\npass: 5000 (50.00%)\""));
+   assert(Contains(dot, "label=\"small\\nentries: 5000\\npass: 500 (10.00%)\\ntime: "));
+   assert(Contains(dot, "label=\"half\\nentries: 500\""));
+   assert(Contains(dot, "label=\"Action(half)\\nentries: 500\""));
+   assert(Contains(dot, "n0 -> n1;") && Contains(dot, "n1 -> n2;") && Contains(dot, "n2 -> n3;") &&
+          Contains(dot, "n3 -> n4;"));
+
+   auto json = small.GetGraph("json");
+   assert(Contains(json, "{\"id\": 2, \"type\": \"Filter\", \"label\": \"small\", \"entries\": 5000, \"pass\": 500, \"time\": "));
+   assert(Contains(json, "{\"from\": 3, \"to\": 4}"));
+
+   bool thrown = false;
+   try {
+      d.GetGraph("svg");
+   } catch (const std::runtime_error &) {
+      thrown = true;
+   }
+   assert(thrown);
+}
+
+int Count(const std::string &s, const std::string &sub)
+{
+   int n = 0;
+   for (auto pos = s.find(sub); pos != std::string::npos; pos = s.find(sub, pos + 1)) ++n;
+   return n;
+}
+
+// the actions of the last run are destroyed: an action booked since, often at the
+// same address, is still a node of its own
+void CheckGraphAfterRun(TFile &f)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   auto filtered = d.Filter([](int i) { return i < 100; });
+   auto c = filtered.Count();
+   assert(*c == 100);
+   auto c2 = filtered.Count();
+
+   const auto json = d.GetGraph("json");
+   assert(Count(json, "\"type\": \"Action\"") == 2);
+   assert(Contains(json, "{\"id\": 2, \"type\": \"Action\", \"label\": \"Action()\", \"entries\": 100}"));
+   assert(Contains(json, "{\"id\": 3, \"type\": \"Action\", \"label\": \"Action()\", \"entries\": 0}"));
+   assert(Contains(json, "{\"from\": 0, \"to\": 1},\n  {\"from\": 1, \"to\": 2},\n  {\"from\": 1, \"to\": 3}"));
+   const auto dot = d.GetGraph();
+   assert(Count(dot, " -> ") == 3 && Contains(dot, "n1 -> n2;") && Contains(dot, "n1 -> n3;"));
+   assert(*c2 == 100);
+}
+
+void CheckProfiling(TFile &f)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   auto sq = d.AddBranch("sq", Square);
+   auto c = sq.Filter([](int sq) { return sq < 100; }, {"sq"}).Count();
+   auto h = sq.Histo<int>("sq");
+
+   // not profiling: only named filters are timed
+   assert(*c == 10);
+   assert(Count(d.GetGraph("json"), "\"time\": ") == 0);
+
+   d.SetProfiling(true);
+   auto c2 = sq.Filter([](int sq) { return sq < 100; }, {"sq"}).Count();
+   assert(*c2 == 10);
+   // the TDataFrame, the branch, both filters and the action of the last run are timed
+   const auto json = d.GetGraph("json");
+   assert(Count(json, "\"time\": ") == 5 && Count(json, "\"time\": -") == 0);
+   assert(Contains(d.GetGraph(), "label=\"graphTree\\nentries: 20000\\ntime: "));
+}
+
+void CheckTracing(TFile &f, unsigned int nTasks)
+{
+   ROOT::TDataFrame d("graphTree", &f, {"i"});
+   auto c = d.Count();
+   assert(*c == 10000);
+   assert(Count(d.GetTrace(), "\"ph\": \"X\"") == 0);
+
+   d.SetTracing(true);
+   auto values = d.Filter([](int i) { return i >= 10; }).Take<int>();
+   assert(values->size() == 9990);
+   const auto trace = d.GetTrace();
+   assert(Contains(trace, "\"traceEvents\": [") && Contains(trace, "\"args\": {\"name\": \"merge\"}"));
+   assert(Count(trace, "\"name\": \"Task\"") == int(nTasks));
+   assert(Count(trace, "\"name\": \"BuildAllReaderValues\"") == int(nTasks));
+   assert(Count(trace, "\"name\": \"Entry loop\"") == int(nTasks));
+   assert(Count(trace, "\"name\": \"Merge\"") == 1);
+   assert(Contains(trace, "\"args\": {\"first entry\": 0, \"entries\": " + std::to_string(10000 / nTasks) + "}"));
+}
+
+int main() {
+   auto fileName = "graphTree.root";
+   auto treeName = "graphTree";
+   FillTree(fileName, treeName);
+   TFile f(fileName);
+
+   CheckSharedNodes(f);
+   CheckMutableCallables(f);
+   CheckFusedActions(f);
+   CheckGraph(f);
+   CheckGraphAfterRun(f);
+   CheckProfiling(f);
+   CheckTracing(f, 1);
+
+   ROOT::EnableImplicitMT(4);
+   CheckSharedNodes(f);
+   CheckFusedActions(f);
+   CheckGraph(f);
+   CheckGraphAfterRun(f);
+   CheckProfiling(f);
+   CheckTracing(f, 10); // one task per cluster
+
+   return 0;
+}
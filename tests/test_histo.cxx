@@ -0,0 +1,255 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+#include "TH2F.h"
+#include "TH3F.h"
+#include "TProfile.h"
+#include "TProfile2D.h"
+
+#include "TDataFrame.hxx"
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+void FillTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   t.SetAutoFlush(1000);
+   double x, y, w;
+   std::vector<double> vx, vy, vw;
+   t.Branch("x", &x);
+   t.Branch("y", &y);
+   t.Branch("vx", &vx);
+   t.Branch("vy", &vy);
+   t.Branch("w", &w);
+   t.Branch("vw", &vw);
+   for (int i = 0; i < 10000; ++i) {
+      x = i - 5000;
+      y = 2 * x;
+      vx.assign(2, x);
+      vy.assign(2, y);
+      w = i % 2 + 0.5;
+      vw.assign(2, w);
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+bool IsClose(double a, double b) { return std::abs(a - b) < 1e-6 * (std::abs(a) + std::abs(b) + 1); }
+
+void FillSmallTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   int i;
+   t.Branch("i", &i);
+   for (i = 0; i < 10; ++i)
+      t.Fill();
+   t.Write();
+   f.Close();
+}
+
+void CheckAutoRange(TFile &f)
+{
+   ROOT::TDataFrame d("histoTree", &f, {"x"});
+   auto hBuffered = d.Histo();
+   d.SetHistoBufferSize(100); // far fewer than the number of entries
+   auto hBounded = d.Histo();
+   auto hBoundedFiltered = d.Filter([](double x) { return x > 0; }).Histo();
+
+   assert(hBuffered->GetEntries() == 10000);
+   assert(hBounded->GetEntries() == 10000);
+   assert(IsClose(hBounded->GetMean(), hBuffered->GetMean()));
+   assert(hBounded->GetBinContent(0) == 0 && hBounded->GetBinContent(hBounded->GetNbinsX() + 1) == 0);
+   assert(hBoundedFiltered->GetEntries() == 4999);
+   assert(IsClose(hBoundedFiltered->GetMean(), 2500));
+}
+
+void CheckMultiDim(TFile &f)
+{
+   ROOT::TDataFrame d("histoTree", &f, {"x", "y"});
+   auto h2 = d.Histo2D(TH2F("h2", "h2", 100, -5000, 5000, 100, -10000, 10000));
+   auto h2v = d.Histo2D<std::vector<double>, std::vector<double>>(
+      TH2F("h2v", "h2v", 100, -5000, 5000, 100, -10000, 10000), "vx", "vy");
+   auto h3 = d.Histo3D(TH3F("h3", "h3", 10, -5000, 5000, 10, -10000, 10000, 10, -5000, 5000), "x", "y", "x");
+   auto p1 = d.Profile1D(TProfile("p1", "p1", 100, -5000, 5000));
+   auto p2 = d.Profile2D(TProfile2D("p2", "p2", 10, -5000, 5000, 10, -10000, 10000), "x", "y", "x");
+
+   assert(h2->GetEntries() == 10000);
+   assert(IsClose(h2->GetMean(1), -0.5) && IsClose(h2->GetMean(2), -1));
+   assert(h2->GetBinContent(1, 1) == 100 && h2->GetBinContent(1, 2) == 0);
+   assert(h2v->GetEntries() == 20000);
+   assert(h2v->GetBinContent(100, 100) == 200);
+   assert(h3->GetEntries() == 10000);
+   assert(IsClose(h3->GetMean(3), -0.5));
+   assert(p1->GetEntries() == 10000);
+   assert(IsClose(p1->GetBinContent(1), -9901)); // mean of 2x for x in [-5000, -4901]
+   assert(p2->GetEntries() == 10000);
+   assert(IsClose(p2->GetBinContent(1, 1), -4500.5));
+}
+
+bool AreEqual(const TH1F &h1, const TH1F &h2)
+{
+   if (h1.GetNbinsX() != h2.GetNbinsX() || h1.GetEntries() != h2.GetEntries()) return false;
+   for (int b = 0; b <= h1.GetNbinsX() + 1; ++b) {
+      if (!IsClose(h1.GetBinContent(b), h2.GetBinContent(b)) || !IsClose(h1.GetBinError(b), h2.GetBinError(b)))
+         return false;
+   }
+   return IsClose(h1.GetMean(), h2.GetMean()) && IsClose(h1.GetStdDev(), h2.GetStdDev());
+}
+
+void CheckWeighted(TFile &f)
+{
+   // the axis is narrower than the range of values, to have under and overflows
+   TH1F model("h", "h", 100, -4000, 4000);
+   const double edges[] = {-6000, -100, 0, 10, 4000};
+   TH1F varModel("hv", "hv", 4, edges);
+   TH1F ref(model), refColl(model), refUnweightedColl(model), refVar(varModel);
+   for (int i = 0; i < 10000; ++i) {
+      double x = i - 5000, w = i % 2 + 0.5;
+      ref.Fill(x, w);
+      refVar.Fill(x, w);
+      for (int j = 0; j < 2; ++j) {
+         refColl.Fill(x, w);
+         refUnweightedColl.Fill(x);
+      }
+   }
+
+   ROOT::TDataFrame d("histoTree", &f, {"x", "w"});
+   auto h = d.Histo("x", "w", model);
+   auto hColls = d.Histo<std::vector<double>, std::vector<double>>("vx", "vw", model);
+   auto hCollScalar = d.Histo<std::vector<double>, double>("vx", "w", model);
+   auto hUnweightedColl = d.Histo<std::vector<double>>("vx", model);
+   auto hVar = d.Histo("x", "w", varModel);
+   auto hAuto = d.Histo("x", "w");
+   d.SetHistoBufferSize(100);
+   auto hBounded = d.Histo<std::vector<double>, double>("vx", "w");
+
+   assert(AreEqual(*h, ref));
+   assert(AreEqual(*hColls, refColl));
+   assert(AreEqual(*hCollScalar, refColl));
+   assert(AreEqual(*hUnweightedColl, refUnweightedColl));
+   assert(AreEqual(*hVar, refVar));
+   assert(IsClose(hAuto->GetSumOfWeights(), 10000) && IsClose(hAuto->GetMean(), ref.GetMean()));
+   assert(hBounded->GetEntries() == 20000);
+   assert(IsClose(hBounded->GetSumOfWeights(), 20000) && IsClose(hBounded->GetMean(), ref.GetMean()));
+}
+
+void CheckShared(TFile &f)
+{
+   TH1F model("h", "h", 100, -4000, 4000);
+   TH1F ref(model), refWeighted(model);
+   for (int i = 0; i < 10000; ++i) {
+      ref.Fill(i - 5000);
+      refWeighted.Fill(i - 5000, i % 2 + 0.5);
+   }
+
+   ROOT::TDataFrame d("histoTree", &f, {"x", "y"});
+   d.SetHistoMemoryThreshold(0); // all slots fill the same histogram when running in parallel
+   auto h = d.Histo("x", model);
+   auto hWeighted = d.Histo("x", "w", model);
+   auto h2 = d.Histo2D(TH2F("h2", "h2", 100, -5000, 5000, 100, -10000, 10000));
+   auto h3 = d.Histo3D(TH3F("h3", "h3", 10, -5000, 5000, 10, -10000, 10000, 10, -5000, 5000), "x", "y", "x");
+   auto p1 = d.Profile1D(TProfile("p1", "p1", 100, -5000, 5000));
+
+   assert(AreEqual(*h, ref));
+   assert(AreEqual(*hWeighted, refWeighted));
+   assert(h2->GetEntries() == 10000);
+   assert(IsClose(h2->GetMean(1), -0.5) && IsClose(h2->GetMean(2), -1));
+   assert(h2->GetBinContent(1, 1) == 100 && h2->GetBinContent(1, 2) == 0);
+   assert(h3->GetEntries() == 10000);
+   assert(IsClose(h3->GetMean(3), -0.5));
+   assert(h3->GetBinContent(1, 1, 1) == 1000);
+   assert(IsClose(p1->GetBinContent(1), -9901));
+}
+
+// a user-defined accumulator, with the methods needed by TDataFrame::Fill
+class TWeightedSum : public TObject {
+public:
+   double fSum = 0;
+   int fN = 0;
+   void Fill(double x, double w)
+   {
+      fSum += x * w;
+      ++fN;
+   }
+   Long64_t Merge(TCollection *list)
+   {
+      TIter next(list);
+      while (auto obj = next()) {
+         auto other = static_cast<TWeightedSum *>(obj);
+         fSum += other->fSum;
+         fN += other->fN;
+      }
+      return fN;
+   }
+};
+
+void CheckFill(TFile &f)
+{
+   ROOT::TDataFrame d("histoTree", &f, {"x", "w"});
+   auto sum = d.Fill<double, double>(TWeightedSum());
+   auto sumColls = d.Fill<std::vector<double>, std::vector<double>>(TWeightedSum(), {"vx", "vw"});
+   auto p = d.Fill<double, double>(TProfile("p", "p", 100, -5000, 5000), {"x", "y"});
+
+   double ref = 0;
+   for (int i = 0; i < 10000; ++i) ref += (i - 5000) * (i % 2 + 0.5);
+   assert(sum->fN == 10000 && IsClose(sum->fSum, ref));
+   assert(sumColls->fN == 20000 && IsClose(sumColls->fSum, 2 * ref));
+   assert(p->GetEntries() == 10000);
+   assert(IsClose(p->GetBinContent(1), -9901));
+}
+
+// counts the copies made of it, e.g. when a processing slot gets its own object
+class TCountedSum : public TWeightedSum {
+public:
+   static std::atomic<int> fgNCopies;
+   TCountedSum() = default;
+   TCountedSum(const TCountedSum &other) : TWeightedSum(other) { ++fgNCopies; }
+};
+std::atomic<int> TCountedSum::fgNCopies(0);
+
+// a single cluster: when running in parallel, only one slot processes entries and the
+// other slots must not get a copy of the filled object
+void CheckSingleCluster(TFile &f)
+{
+   ROOT::TDataFrame d("smallTree", &f, {"i"});
+   TCountedSum::fgNCopies = 0;
+   auto sum = d.Fill<int, int>(TCountedSum(), {"i", "i"});
+   auto h = d.Histo<int>("i", TH1F("h", "h", 10, 0, 10));
+   auto hAuto = d.Histo<int>();
+
+   assert(sum->fN == 10 && sum->fSum == 285);
+   // the copy stored by Fill and the model kept to create the slot objects
+   assert(TCountedSum::fgNCopies <= 2);
+   assert(h->GetEntries() == 10 && h->GetBinContent(1) == 1);
+   assert(hAuto->GetEntries() == 10);
+}
+
+int main() {
+   auto fileName = "histoTree.root";
+   auto treeName = "histoTree";
+   FillTree(fileName, treeName);
+   TFile f(fileName);
+   FillSmallTree("smallTree.root", "smallTree");
+   TFile smallF("smallTree.root");
+
+   CheckAutoRange(f);
+   CheckMultiDim(f);
+   CheckWeighted(f);
+   CheckShared(f);
+   CheckFill(f);
+   CheckSingleCluster(smallF);
+
+   ROOT::EnableImplicitMT(4);
+   CheckAutoRange(f);
+   CheckMultiDim(f);
+   CheckWeighted(f);
+   CheckShared(f);
+   CheckFill(f);
+   CheckSingleCluster(smallF);
+
+   return 0;
+}
@@ -0,0 +1,160 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+
+#include "TDataFrame.hxx"
+
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+void FillTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   t.SetAutoFlush(1000);
+   int i;
+   t.Branch("i", &i);
+   for (i = 0; i < 10000; ++i)
+      t.Fill();
+   t.Write();
+   f.Close();
+}
+
+void CheckReport(TFile &f)
+{
+   ROOT::TDataFrame d("reportTree", &f, {"i"});
+   auto even = d.Filter([](int i) { return i % 2 == 0; }, "even");
+   auto unnamed = even.Filter([](int i) { return i < 9000; });
+   auto small = unnamed.Filter([](int i) { return i < 1000; }, {"i"}, "small");
+   auto byFour = even.Filter([](int i) { return i % 4 == 0; }, {"i"});
+   auto c = small.Count();
+   auto c4 = byFour.Count();
+   auto rep = small.Report();
+
+   assert(*c == 500 && *c4 == 2500);
+   assert(rep->size() == 2);
+   auto &evenCut = (*rep)["even"];
+   assert(evenCut.GetAll() == 10000 && evenCut.GetPass() == 5000 && evenCut.GetEff() == 0.5);
+   assert(evenCut.GetTime() >= 0.);
+   auto &smallCut = (*rep)["small"];
+   assert(smallCut.GetAll() == 4500 && smallCut.GetPass() == 500);
+   assert(rep->begin()->GetName() == "even");
+   bool thrown = false;
+   try {
+      (*rep)["odd"];
+   } catch (const std::runtime_error &) {
+      thrown = true;
+   }
+   assert(thrown);
+
+   // filters not needed by any action are not evaluated
+   auto rep2 = d.Report();
+   assert((*rep2)["even"].GetAll() == 10000);
+
+   // the statistics add up over event loops
+   auto c2 = small.Count();
+   auto rep3 = d.Report();
+   assert(*c2 == 500);
+   assert((*rep3)["even"].GetAll() == 20000 && (*rep3)["small"].GetPass() == 1000);
+}
+
+bool IsEvenSlowly(int i)
+{
+   double x = i;
+   for (int j = 0; j < 100; ++j) x = std::sqrt(x * x + 1.);
+   return x > 0 && i % 2 == 0;
+}
+
+bool IsMultipleSlowly(int i, int n)
+{
+   double x = i;
+   for (int j = 0; j < 100; ++j) x = std::sqrt(x * x + 1.);
+   return x > 0 && i % n == 0;
+}
+
+// the selectivities of the filters swap between two event loops: the second one
+// samples the filters again and finds the new best order
+void CheckReorderingTwoRuns(TFile &f)
+{
+   ROOT::TDataFrame d("reportTree", &f, {"i"});
+   d.SetFilterReordering(true);
+   int run = 0;
+   auto filtered = d.Filter([&run](int i) { return IsMultipleSlowly(i, 10) == (run == 0); }, "byTen")
+                      .Filter([&run](int i) { return IsMultipleSlowly(i, 3) == (run == 1); }, "byThree");
+   auto c1 = filtered.Count();
+   auto rep1 = d.Report();
+   assert(*c1 == 666);
+   // byTen discards 90% of the entries, byThree 33%
+   const auto byTenAll1 = (*rep1)["byTen"].GetAll();
+   const auto byThreeAll1 = (*rep1)["byThree"].GetAll();
+   assert(byTenAll1 == 10000 && byThreeAll1 < 10000);
+
+   run = 1;
+   auto c2 = filtered.Count();
+   auto rep2 = d.Report();
+   assert(*c2 == 3000);
+   // byTen now discards 10% of the entries, byThree 67%
+   assert((*rep2)["byThree"].GetAll() - byThreeAll1 == 10000);
+   assert((*rep2)["byTen"].GetAll() - byTenAll1 < 10000);
+}
+
+void CheckReordering(TFile &f)
+{
+   ROOT::TDataFrame d("reportTree", &f, {"i"});
+   d.SetFilterReordering(true);
+   auto filtered = d.Filter(IsEvenSlowly, "even")
+                      .AddBranch("j", [](int i) { return i / 10; })
+                      .Filter([](int i) { return i % 10 == 0; }, "byTen")
+                      .Filter([](int j) { return j >= 0; }, {"j"}, "positive");
+   auto c = filtered.Count();
+   auto mid = d.Filter([](int i) { return i < 5000; }).Count();
+   auto rep = d.Report();
+
+   assert(*c == 1000 && *mid == 5000);
+   // the cheap filter discarding most entries is evaluated first, on all entries
+   assert((*rep)["byTen"].GetAll() == 10000 && (*rep)["byTen"].GetPass() == 1000);
+   assert((*rep)["even"].GetAll() < 10000 && (*rep)["positive"].GetAll() < 10000);
+}
+
+void CheckRunStats(TFile &f)
+{
+   ROOT::TDataFrame d("reportTree", &f, {"i"});
+   assert(d.GetRunStats().GetEntries() == 0 && d.GetRunStats().GetSlotEntries().empty());
+
+   auto c = d.Filter([](int i) { return i < 10; }).Count();
+   assert(*c == 10);
+   const auto stats = d.GetRunStats();
+   ULong64_t slotEntries = 0;
+   for (auto entries : stats.GetSlotEntries()) slotEntries += entries;
+   assert(stats.GetEntries() == 10000 && slotEntries == 10000);
+   assert(stats.GetSlotEntries().size() == ROOT::Internal::GetNSlots());
+   assert(stats.GetBytesRead() > 0 && stats.GetUncompressedBytes() >= stats.GetBytesRead());
+   assert(stats.GetWallTime() > 0 && stats.GetCpuTime() >= 0 && stats.GetEntriesPerSecond() > 0);
+   const auto json = stats.AsJson();
+   assert(json.find("{\"entries\": 10000, ") == 0 && json.find("\"slot_entries\": [") != std::string::npos);
+
+   // the statistics are those of the last run only
+   auto c2 = d.Count();
+   assert(*c2 == 10000 && d.GetRunStats().GetEntries() == 10000);
+}
+
+int main() {
+   auto fileName = "reportTree.root";
+   auto treeName = "reportTree";
+   FillTree(fileName, treeName);
+   TFile f(fileName);
+
+   CheckReport(f);
+   CheckReordering(f);
+   CheckReorderingTwoRuns(f);
+   CheckRunStats(f);
+
+   ROOT::EnableImplicitMT(4);
+   CheckReport(f);
+   CheckReordering(f);
+   CheckReorderingTwoRuns(f);
+   CheckRunStats(f);
+
+   return 0;
+}
@@ -0,0 +1,190 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+#include "TH1F.h"
+
+#include "TDataFrame.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+void FillTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   t.SetAutoFlush(1000);
+   double x;
+   int u;
+   std::vector<double> vx;
+   t.Branch("x", &x);
+   t.Branch("u", &u);
+   t.Branch("vx", &vx);
+   for (int i = 0; i < 10000; ++i) {
+      // a large offset: the textbook formula for the variance would lose all significant digits
+      x = 1e9 + i % 10;
+      vx.assign(2, i % 10);
+      u = (i * 7919) % 10000; // all integers from 0 to 9999, shuffled
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+bool IsClose(double a, double b) { return std::abs(a - b) < 1e-9 * (std::abs(a) + std::abs(b) + 1); }
+
+void CheckStats(TFile &f)
+{
+   // variance of ten equally populated values 0..9, with n - 1 in the denominator
+   const double variance = 8.25 * 10000 / 9999;
+   const double vVariance = 8.25 * 20000 / 19999;
+
+   ROOT::TDataFrame d("statsTree", &f, {"x"});
+   auto sum = d.Sum();
+   auto var = d.Variance();
+   auto stdDev = d.StdDev();
+   auto stats = d.Stats();
+   auto vStats = d.Stats<std::vector<double>>("vx");
+   auto vSum = d.Sum<std::vector<double>>("vx");
+   auto mean = d.Mean();
+   auto none = d.Filter([](double x) { return x < 0; }).Stats();
+
+   assert(*sum == 1e13 + 45000);
+   assert(IsClose(*var, variance));
+   assert(IsClose(*stdDev, std::sqrt(variance)));
+   assert(stats->GetN() == 10000);
+   assert(stats->GetSum() == *sum);
+   assert(IsClose(stats->GetMean(), 1e9 + 4.5));
+   assert(IsClose(stats->GetVariance(), variance));
+   assert(stats->GetMin() == 1e9 && stats->GetMax() == 1e9 + 9);
+   assert(vStats->GetN() == 20000);
+   assert(IsClose(vStats->GetMean(), 4.5) && IsClose(vStats->GetVariance(), vVariance));
+   assert(*vSum == 90000);
+   assert(IsClose(*mean, 1e9 + 4.5));
+   assert(none->GetN() == 0 && none->GetVariance() == 0);
+}
+
+void CheckCovariance(TFile &f)
+{
+   const double variance = 8.25 * 10000 / 9999;
+   ROOT::TDataFrame d("statsTree", &f, {"x"});
+   auto cov = d.AddBranch("b", [](double x) { return 2 * x - 3; })
+                 .AddBranch("c", [](double x) { return -x; })
+                 .Covariance({"x", "b", "c"});
+
+   assert(cov->GetN() == 10000);
+   assert(cov->GetNames().size() == 3);
+   assert(IsClose(cov->GetMean(0), 1e9 + 4.5) && IsClose(cov->GetMean(1), 2e9 + 6));
+   assert(IsClose(cov->GetCovariance(0, 0), variance));
+   assert(IsClose(cov->GetCovariance(0, 1), 2 * variance) && cov->GetCovariance(1, 0) == cov->GetCovariance(0, 1));
+   assert(IsClose(cov->GetCovariance(1, 1), 4 * variance));
+   assert(IsClose(cov->GetCovariance(1, 2), -2 * variance));
+   assert(IsClose(cov->GetCorrelation(0, 1), 1) && IsClose(cov->GetCorrelation(0, 2), -1));
+}
+
+void CheckQuantiles(TFile &f)
+{
+   const std::vector<double> qs = {0., 0.001, 0.1, 0.5, 0.9, 0.999, 1.};
+   ROOT::TDataFrame d("statsTree", &f, {"u"});
+   auto quantiles = d.Quantiles<int>("u", qs);
+   auto coarse = d.Quantiles<int>("u", qs, 50);
+   auto vQuantiles = d.Quantiles<std::vector<double>>("vx", {0.5});
+   auto none = d.Filter([](int u) { return u < 0; }).Quantiles<int>("u", {0.5});
+
+   assert(quantiles->size() == qs.size());
+   assert((*quantiles)[0] == 0 && (*quantiles)[qs.size() - 1] == 9999);
+   for (std::size_t i = 0; i < qs.size(); ++i) {
+      // the documented bound on the fraction of values between estimate and exact quantile
+      const double q = qs[i];
+      const double exact = q * 9999;
+      assert(std::abs((*quantiles)[i] - exact) <= 3.1416 * std::sqrt(q * (1 - q)) / 200 * 10000 + 1);
+      assert(std::abs((*coarse)[i] - exact) <= 3.1416 * std::sqrt(q * (1 - q)) / 50 * 10000 + 1);
+   }
+   assert(vQuantiles->size() == 1 && std::abs((*vQuantiles)[0] - 4.5) <= 0.5);
+   assert(none->size() == 1 && (*none)[0] == 0);
+}
+
+void CheckCountDistinct(TFile &f)
+{
+   ROOT::TDataFrame d("statsTree", &f, {"u"});
+   auto nU = d.CountDistinct<int>();
+   auto nX = d.CountDistinct("x");
+   auto nVx = d.CountDistinct<std::vector<double>>("vx");
+   auto nUApprox = d.CountDistinct<int>("u", 14);
+   auto nXApprox = d.CountDistinct("x", 10);
+   auto nNone = d.Filter([](int u) { return u < 0; }).CountDistinct<int>("u", 14);
+
+   assert(*nU == 10000);
+   assert(*nX == 10);
+   assert(*nVx == 10);
+   assert(std::abs(double(*nUApprox) - 10000) < 0.04 * 10000); // five standard errors
+   assert(std::abs(double(*nXApprox) - 10) <= 1);
+   assert(*nNone == 0);
+}
+
+void CheckGroupBy(TFile &f)
+{
+   ROOT::TDataFrame d("statsTree", &f, {"u"});
+   auto byKey = d.AddBranch("k", [](int u) { return u % 5; }).GroupBy<int>("k");
+   auto counts = byKey.Count();
+   auto sums = byKey.Aggregate<int>([](double s, int u) { return s + u; }, std::plus<double>());
+   auto maxs = byKey.Aggregate<int>([](int m, int u) { return std::max(m, u); },
+                                    [](int m1, int m2) { return std::max(m1, m2); }, "u", -1);
+   auto hists = byKey.Histo<int>("u", TH1F("h", "h", 10, 0, 10000));
+   auto defaultHists = byKey.Histo<int>("", TH1F("h", "h", 10, 0, 10000));
+
+   assert(counts->size() == 5 && sums->size() == 5 && maxs->size() == 5 && hists->size() == 5);
+   for (int k = 0; k < 5; ++k) {
+      assert(counts->at(k) == 2000);
+      assert(sums->at(k) == 9995000 + 2000 * k);
+      assert(maxs->at(k) == 9995 + k);
+      const auto &h = hists->at(k);
+      assert(h.GetEntries() == 2000);
+      for (int b = 1; b <= 10; ++b) assert(h.GetBinContent(b) == 200);
+      assert(defaultHists->at(k).GetEntries() == 2000);
+   }
+}
+
+// partial results much larger than the memory budget: they are spilled to temporary files
+void CheckSpill(TFile &f)
+{
+   ROOT::TDataFrame d("statsTree", &f, {"u"});
+   d.SetActionMemoryBudget(4096);
+   auto nU = d.CountDistinct<int>();
+   auto nVx = d.CountDistinct<std::vector<double>>("vx");
+   auto sorted = d.TakeSorted<int>();
+   auto byKey = d.AddBranch("k", [](int u) { return u % 1000; }).GroupBy<int>("k");
+   auto sums = byKey.Aggregate<int>([](double s, int u) { return s + u; }, std::plus<double>());
+
+   assert(*nU == 10000);
+   assert(*nVx == 10);
+   assert(sorted->size() == 10000);
+   for (int i = 0; i < 10000; ++i) assert((*sorted)[i] == i);
+   assert(sums->size() == 1000);
+   for (int k = 0; k < 1000; ++k) assert(sums->at(k) == 10 * k + 45000); // sum of 1000 * j + k for j in [0, 10)
+}
+
+int main() {
+   auto fileName = "statsTree.root";
+   auto treeName = "statsTree";
+   FillTree(fileName, treeName);
+   TFile f(fileName);
+
+   CheckStats(f);
+   CheckCovariance(f);
+   CheckQuantiles(f);
+   CheckCountDistinct(f);
+   CheckGroupBy(f);
+   CheckSpill(f);
+
+   ROOT::EnableImplicitMT(4);
+   CheckStats(f);
+   CheckCovariance(f);
+   CheckQuantiles(f);
+   CheckCountDistinct(f);
+   CheckGroupBy(f);
+   CheckSpill(f);
+
+   return 0;
+}
@@ -0,0 +1,126 @@
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+
+#include "TDataFrame.hxx"
+
+#include <cassert>
+#include <functional>
+#include <utility>
+#include <vector>
+
+void FillTree(const char* filename, const char* treeName) {
+   TFile f(filename, "RECREATE");
+   TTree t(treeName, treeName);
+   t.SetAutoFlush(1000); // several clusters, processed concurrently in the MT case
+   int i;
+   std::vector<double> v;
+   t.Branch("i", &i);
+   t.Branch("v", &v);
+   for (i = 0; i < 10000; ++i) {
+      v.assign(i % 4, i); // i % 4 elements with value i
+      t.Fill();
+   }
+   t.Write();
+   f.Close();
+}
+
+void CheckTakeOrdered(TFile &f)
+{
+   ROOT::TDataFrame d("takeTree", &f, {"i"});
+   auto all = d.TakeOrdered<int>();
+   auto odd = d.Filter([](int i) { return i % 2 == 1; }).TakeOrdered<int>("i", 0.5);
+
+   assert(all->size() == 10000);
+   for (int i = 0; i < 10000; ++i)
+      assert((*all)[i] == i);
+
+   assert(odd->size() == 5000);
+   for (int i = 0; i < 5000; ++i)
+      assert((*odd)[i] == 2 * i + 1);
+}
+
+void CheckTakeFlat(TFile &f)
+{
+   ROOT::TDataFrame d("takeTree", &f, {"v"});
+   auto flat = d.TakeFlat<double>();
+   auto colls = d.TakeOrdered<std::vector<double>>();
+   auto unordered = d.Take<std::vector<double>>();
+
+   // one collection per entry, in any order with implicit multi-threading
+   assert(unordered->size() == 10000);
+   std::vector<int> nTaken(10000, 0);
+   int nEmpty = 0;
+   for (auto &coll : *unordered) {
+      if (coll.empty()) {
+         ++nEmpty;
+         continue;
+      }
+      const int i = coll[0];
+      assert(coll.size() == std::size_t(i % 4));
+      for (auto v : coll) assert(v == i);
+      ++nTaken[i];
+   }
+   assert(nEmpty == 2500);
+   for (int i = 0; i < 10000; ++i) assert(nTaken[i] == (i % 4 ? 1 : 0));
+
+   assert(flat->GetNEntries() == 10000);
+   assert(flat->GetValues().size() == 15000);
+   assert(colls->size() == 10000);
+   const auto &offsets = flat->GetOffsets();
+   const auto &values = flat->GetValues();
+   assert(offsets.size() == 10001 && offsets.front() == 0 && offsets.back() == values.size());
+   for (int i = 0; i < 10000; ++i) {
+      const auto &coll = (*colls)[i];
+      assert(coll.size() == std::size_t(i % 4));
+      assert(offsets[i + 1] - offsets[i] == coll.size());
+      assert(flat->GetSize(i) == coll.size());
+      for (std::size_t j = 0; j < coll.size(); ++j) {
+         assert(values[offsets[i] + j] == coll[j]);
+         assert(flat->GetData(i)[j] == coll[j]);
+      }
+   }
+}
+
+void CheckSorted(TFile &f)
+{
+   ROOT::TDataFrame d("takeTree", &f, {"i"});
+   auto top = d.TopK<int>("i", 5);
+   auto bottom = d.TopK<int>("i", 3, std::greater<int>());
+   auto all = d.TopK<int>("i", 20000);
+   auto sortedDown = d.TakeSorted<int>("i", std::greater<int>());
+   auto sortedOdd = d.Filter([](int i) { return i % 2 == 1; }).TakeSorted<int>();
+   // select entries by a "weight": (weight, entry) pairs compared by weight
+   using WE_t = std::pair<int, int>;
+   auto heaviest = d.AddBranch("we", [](int i) { return WE_t((i * 7919) % 10000, i); })
+                      .TopK<WE_t>("we", 2, [](const WE_t &a, const WE_t &b) { return a.first < b.first; });
+
+   assert(top->size() == 5);
+   for (int i = 0; i < 5; ++i) assert((*top)[i] == 9999 - i);
+   assert(bottom->size() == 3 && (*bottom)[0] == 0 && (*bottom)[2] == 2);
+   assert(all->size() == 10000 && all->front() == 9999 && all->back() == 0);
+   assert(sortedDown->size() == 10000);
+   for (int i = 0; i < 10000; ++i) assert((*sortedDown)[i] == 9999 - i);
+   assert(sortedOdd->size() == 5000);
+   for (int i = 0; i < 5000; ++i) assert((*sortedOdd)[i] == 2 * i + 1);
+   assert(heaviest->size() == 2 && (*heaviest)[0].first == 9999 && (*heaviest)[1].first == 9998);
+   assert(((*heaviest)[0].second * 7919) % 10000 == 9999);
+}
+
+int main() {
+   auto fileName = "takeTree.root";
+   auto treeName = "takeTree";
+   FillTree(fileName, treeName);
+   TFile f(fileName);
+
+   CheckTakeOrdered(f);
+   CheckTakeFlat(f);
+   CheckSorted(f);
+
+   ROOT::EnableImplicitMT(4);
+   CheckTakeOrdered(f);
+   CheckTakeFlat(f);
+   CheckSorted(f);
+
+   return 0;
+}